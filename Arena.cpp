@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2015 Jochen Neubeck
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INTERNET SOFTWARE CONSORTIUM DISCLAIMS
+ * ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL INTERNET SOFTWARE
+ * CONSORTIUM BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS
+ * ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+ * SOFTWARE.
+ */
+#include <windows.h>
+#include "Arena.h"
+
+#ifdef _WIN64
+static SIZE_T const MaxRegionSize = 0x10000000;
+#else
+static SIZE_T const MaxRegionSize = 0x1000000;
+#endif
+static SIZE_T const CommitSize = 0x100000;
+
+// GetLargePageMinimum() is available as of Windows Server 2003, so look it up dynamically
+static SIZE_T (WINAPI *const GetLargePageMinimumProc)() =
+	reinterpret_cast<SIZE_T (WINAPI *)()>(
+		GetProcAddress(GetModuleHandle(TEXT("KERNEL32")), "GetLargePageMinimum"));
+
+static ULONGLONG Budget = 0; // committed octets beyond which to spill, or 0 if unlimited
+static SIZE_T LargePageSize = 0; // size of large pages if to use them, or else 0
+static LONGLONG volatile Committed = 0; // committed octets across all arenas
+
+// A region sits at the start of its own address range
+struct Arena::Region
+{
+	Region *next;
+	HANDLE mapping; // file mapping if spilled, or else NULL
+	SIZE_T size; // reserved octets
+	SIZE_T committed; // committed octets, which don't count if spilled
+	bool large; // whether backed by large pages
+};
+
+/**
+ * @brief Applies settings to regions which get reserved from now on.
+ * @param [in] budget Committed octets beyond which to spill, or 0 if unlimited.
+ * @param [in] largepages Whether to try to back regions by large pages, which
+ * takes the SeLockMemoryPrivilege.
+ */
+void Arena::configure(ULONGLONG budget, bool largepages)
+{
+	Budget = budget;
+	LargePageSize = 0;
+	if (!largepages || GetLargePageMinimumProc == NULL)
+		return;
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		return;
+	TOKEN_PRIVILEGES tp;
+	tp.PrivilegeCount = 1;
+	tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	// AdjustTokenPrivileges() succeeds even if the privilege is not held,
+	// so check for ERROR_SUCCESS rather than ERROR_NOT_ALL_ASSIGNED
+	if (LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL) &&
+		GetLastError() == ERROR_SUCCESS)
+	{
+		LargePageSize = GetLargePageMinimumProc();
+	}
+	CloseHandle(token);
+}
+
+/**
+ * @brief Allocates size octets, aligned on 16 octets.
+ * @return Pointer to the memory, or NULL if out of memory.
+ */
+void *Arena::allocate(size_t size)
+{
+	size = size + 15 & ~static_cast<size_t>(15);
+	if (m_region == NULL ||
+		size > static_cast<SIZE_T>(reinterpret_cast<BYTE *>(m_region) + m_region->committed - m_next))
+	{
+		if (!grow(size))
+			return NULL;
+	}
+	void *const p = m_next;
+	m_next += size;
+	return p;
+}
+
+/**
+ * @brief Makes room for wanted octets, by committing more of m_region if
+ * possible, or else by starting a new region.
+ */
+bool Arena::grow(size_t wanted)
+{
+	if (Region *const region = m_region)
+	{
+		BYTE *const base = reinterpret_cast<BYTE *>(region);
+		SIZE_T const needed = m_next + wanted - base;
+		if (region->mapping == NULL && !region->large && needed <= region->size)
+		{
+			SIZE_T const step = (needed - region->committed + CommitSize - 1) & ~(CommitSize - 1);
+			SIZE_T const committed = region->committed + step < region->size ? region->committed + step : region->size;
+			if (Budget == 0 || static_cast<ULONGLONG>(Committed) + (committed - region->committed) <= Budget)
+			{
+				if (VirtualAlloc(base + region->committed, committed - region->committed, MEM_COMMIT, PAGE_READWRITE) == NULL)
+					return false;
+				InterlockedExchangeAdd64(&Committed, committed - region->committed);
+				region->committed = committed;
+				return true;
+			}
+		}
+	}
+	// Have regions grow along with the arena, so that small files don't take
+	// much, while large ones don't take many regions
+	SIZE_T size = CommitSize;
+	if (m_region && m_region->size < MaxRegionSize)
+		size = m_region->size * 2;
+	else if (m_region)
+		size = MaxRegionSize;
+	SIZE_T const needed = sizeof(Region) + 15 + wanted;
+	while (size < needed)
+		size *= 2;
+	Region *region = NULL;
+	if (Budget == 0 || static_cast<ULONGLONG>(Committed) + CommitSize <= Budget)
+		region = reserve(size);
+	if (region == NULL)
+		region = spill(size);
+	if (region == NULL)
+		return false;
+	// Now that the region before has filled up, spill its pages to the file
+	if (m_region && m_region->mapping)
+		VirtualUnlock(m_region, m_region->size);
+	region->next = m_region;
+	m_region = region;
+	m_next = reinterpret_cast<BYTE *>(region) + (sizeof(Region) + 15 & ~static_cast<size_t>(15));
+	return true;
+}
+
+Arena::Region *Arena::reserve(size_t size)
+{
+	BYTE *base = NULL;
+	SIZE_T committed = 0;
+	bool large = false;
+	if (LargePageSize != 0)
+	{
+		SIZE_T const rounded = (size + LargePageSize - 1) & ~(LargePageSize - 1);
+		if (Budget == 0 || static_cast<ULONGLONG>(Committed) + rounded <= Budget)
+		{
+			base = static_cast<BYTE *>(VirtualAlloc(NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+			if (base)
+			{
+				size = committed = rounded;
+				large = true;
+			}
+		}
+	}
+	if (base == NULL)
+	{
+		base = static_cast<BYTE *>(VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS));
+		if (base == NULL)
+			return NULL;
+		committed = CommitSize;
+		if (VirtualAlloc(base, committed, MEM_COMMIT, PAGE_READWRITE) == NULL)
+		{
+			VirtualFree(base, 0, MEM_RELEASE);
+			return NULL;
+		}
+	}
+	InterlockedExchangeAdd64(&Committed, committed);
+	Region *const region = reinterpret_cast<Region *>(base);
+	region->mapping = NULL;
+	region->size = size;
+	region->committed = committed;
+	region->large = large;
+	return region;
+}
+
+/**
+ * @brief Reserves a region as a view of m_spill, which gets created first if
+ * need be, and removes itself once closed.
+ */
+Arena::Region *Arena::spill(size_t size)
+{
+	if (m_spill == INVALID_HANDLE_VALUE)
+	{
+		TCHAR path[MAX_PATH];
+		TCHAR name[MAX_PATH];
+		if (GetTempPath(_countof(path), path) == 0 || GetTempFileName(path, TEXT("idx"), 0, name) == 0)
+			return NULL;
+		m_spill = CreateFile(name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+		if (m_spill == INVALID_HANDLE_VALUE)
+		{
+			DeleteFile(name);
+			return NULL;
+		}
+	}
+	ULARGE_INTEGER end;
+	end.QuadPart = m_spilled + size;
+	HANDLE const mapping = CreateFileMapping(m_spill, NULL, PAGE_READWRITE, end.HighPart, end.LowPart, NULL);
+	if (mapping == NULL)
+		return NULL;
+	ULARGE_INTEGER offset;
+	offset.QuadPart = m_spilled;
+	BYTE *const base = static_cast<BYTE *>(MapViewOfFile(mapping, FILE_MAP_WRITE, offset.HighPart, offset.LowPart, size));
+	if (base == NULL)
+	{
+		CloseHandle(mapping);
+		return NULL;
+	}
+	m_spilled = end.QuadPart;
+	Region *const region = reinterpret_cast<Region *>(base);
+	region->mapping = mapping;
+	region->size = size;
+	region->committed = size;
+	region->large = false;
+	return region;
+}
+
+/**
+ * @brief Gives back all memory at once, touching only the region headers.
+ */
+void Arena::release()
+{
+	while (Region *const region = m_region)
+	{
+		m_region = region->next;
+		if (HANDLE const mapping = region->mapping)
+		{
+			UnmapViewOfFile(region);
+			CloseHandle(mapping);
+		}
+		else
+		{
+			InterlockedExchangeAdd64(&Committed, -static_cast<LONGLONG>(region->committed));
+			VirtualFree(region, 0, MEM_RELEASE);
+		}
+	}
+	m_next = NULL;
+	if (m_spill != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_spill);
+		m_spill = INVALID_HANDLE_VALUE;
+	}
+	m_spilled = 0;
+}
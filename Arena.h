@@ -0,0 +1,29 @@
+/**
+ * @brief Memory from which to allocate data which lives until all of it goes
+ * at once, as do the compacted blocks of a LineIndex. Regions of address space
+ * get reserved as needed, growing in size along with the arena, and committed
+ * in steps, or at once if backed by large pages. Once committed memory across
+ * all arenas exceeds the budget, further regions are views of a temporary file
+ * of the arena's own, from which the pages of regions that have filled up are
+ * trimmed so as to spill them to the file rather than the page file.
+ */
+class Arena
+{
+public:
+	Arena() : m_region(NULL), m_next(NULL), m_spill(INVALID_HANDLE_VALUE), m_spilled(0) { }
+	~Arena() { release(); }
+	static void configure(ULONGLONG budget, bool largepages);
+	void *allocate(size_t);
+	void release();
+private:
+	struct Region;
+	bool grow(size_t);
+	Region *reserve(size_t);
+	Region *spill(size_t);
+	Region *m_region; // region from which to allocate, linking to those filled before
+	BYTE *m_next; // next allocation within m_region
+	HANDLE m_spill; // temporary file which backs regions beyond the budget
+	ULONGLONG m_spilled; // size of m_spill
+	Arena(const Arena &);
+	Arena &operator=(const Arena &);
+};
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2015 Jochen Neubeck
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INTERNET SOFTWARE CONSORTIUM DISCLAIMS
+ * ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL INTERNET SOFTWARE
+ * CONSORTIUM BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS
+ * ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+ * SOFTWARE.
+ */
+#include <windows.h>
+#include "ColumnIndex.h"
+
+ColumnIndex::Checkpoint const *ColumnIndex::lookup(ULONGLONG line, UINT &count)
+{
+	for (UINT i = 0; i < Capacity; ++i)
+	{
+		Slot &slot = m_slots[i];
+		if (slot.checkpoints != NULL && slot.line == line)
+		{
+			slot.used = ++m_clock;
+			count = slot.count;
+			return slot.checkpoints;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Keeps the checkpoints of a line, which have to come from
+ * CoTaskMemAlloc(), and which the index takes ownership of.
+ */
+void ColumnIndex::insert(ULONGLONG line, Checkpoint *checkpoints, UINT count)
+{
+	Slot *victim = m_slots;
+	for (UINT i = 0; i < Capacity; ++i)
+	{
+		Slot &slot = m_slots[i];
+		if (slot.checkpoints == NULL || slot.line == line)
+		{
+			victim = &slot;
+			break;
+		}
+		if (static_cast<int>(slot.used - victim->used) < 0)
+			victim = &slot;
+	}
+	CoTaskMemFree(victim->checkpoints);
+	victim->line = line;
+	victim->checkpoints = checkpoints;
+	victim->count = count;
+	victim->used = ++m_clock;
+}
+
+void ColumnIndex::clear()
+{
+	for (UINT i = 0; i < Capacity; ++i)
+	{
+		CoTaskMemFree(m_slots[i].checkpoints);
+		m_slots[i].checkpoints = NULL;
+	}
+}
+
+/**
+ * @brief Finds the last checkpoint but one at or before column, from which
+ * to start decoding so as to reach column.
+ */
+UINT ColumnIndex::find(Checkpoint const *checkpoints, UINT count, UINT column)
+{
+	UINT lower = 0;
+	UINT upper = count - 1;
+	while (upper - lower > 1)
+	{
+		UINT const middle = lower + (upper - lower) / 2;
+		if (checkpoints[middle].column <= column)
+			lower = middle;
+		else
+			upper = middle;
+	}
+	return lower;
+}
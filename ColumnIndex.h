@@ -0,0 +1,40 @@
+/**
+ * @brief Checkpoints within lines too long to be decoded as a whole whenever
+ * they get drawn, each of which tells at what display column a given octet of
+ * its line lies. Checkpoints sit where decoding may start afresh, so drawing
+ * such a line involves decoding no more than the stretch between those around
+ * the columns in view. The first checkpoint of a line is at its start, the
+ * last one at its end, where its column is the width of the line. Holds the
+ * checkpoints of a few lines, evicting them in order of least recent use.
+ * Like LineCache, it is to be cleared whenever the codepage, the tab width,
+ * or the delimiter change.
+ */
+class ColumnIndex
+{
+public:
+	static UINT const Capacity = 16;
+	struct Checkpoint
+	{
+		UINT offset; // octets into the line
+		UINT column;
+		bool eat; // whether unwrapping is to drop whitespace from here on
+	};
+	ColumnIndex() : m_clock(0) { ZeroMemory(m_slots, sizeof m_slots); }
+	~ColumnIndex() { clear(); }
+	Checkpoint const *lookup(ULONGLONG line, UINT &count);
+	void insert(ULONGLONG line, Checkpoint *, UINT count);
+	void clear();
+	static UINT find(Checkpoint const *, UINT count, UINT column);
+private:
+	struct Slot
+	{
+		ULONGLONG line;
+		Checkpoint *checkpoints;
+		UINT count;
+		UINT used; // value of m_clock as of most recent use
+	};
+	Slot m_slots[Capacity];
+	UINT m_clock;
+	ColumnIndex(const ColumnIndex &);
+	ColumnIndex &operator=(const ColumnIndex &);
+};
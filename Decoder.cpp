@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2015 Jochen Neubeck
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INTERNET SOFTWARE CONSORTIUM DISCLAIMS
+ * ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL INTERNET SOFTWARE
+ * CONSORTIUM BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS
+ * ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+ * SOFTWARE.
+ */
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <stddef.h>
+#include <emmintrin.h>
+#include "Decoder.h"
+
+void DecodeTable::init()
+{
+	ascii = true;
+	for (unsigned i = 0; i < 0x80; ++i)
+		if (units[i] != i)
+			ascii = false;
+}
+
+static size_t DecodeSingleByteGeneric(unsigned char const *p, size_t n, DecodeTable const *table, unsigned short *q)
+{
+	unsigned short const *const units = table->units;
+	for (size_t i = 0; i < n; ++i)
+		q[i] = units[p[i]];
+	return n;
+}
+
+static size_t DecodeSingleByteSSE2(unsigned char const *p, size_t n, DecodeTable const *table, unsigned short *q)
+{
+	if (!table->ascii)
+		return DecodeSingleByteGeneric(p, n, table, q);
+	unsigned short const *const units = table->units;
+	size_t i = 0;
+	__m128i const zero = _mm_setzero_si128();
+	// Widen blocks of octets below 0x80, and look up the others one by one
+	while (i + 16 <= n)
+	{
+		__m128i const x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+		if (_mm_movemask_epi8(x))
+		{
+			for (size_t const j = i + 16; i < j; ++i)
+				q[i] = units[p[i]];
+			continue;
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(q + i), _mm_unpacklo_epi8(x, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(q + i + 8), _mm_unpackhi_epi8(x, zero));
+		i += 16;
+	}
+	while (i < n)
+	{
+		q[i] = units[p[i]];
+		++i;
+	}
+	return n;
+}
+
+static DecodeTableProc ChooseDecodeSingleByte()
+{
+#ifdef _M_IX86
+	if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		return DecodeSingleByteGeneric;
+#endif
+	return DecodeSingleByteSSE2;
+}
+
+DecodeTableProc const DecodeSingleByte = ChooseDecodeSingleByte();
+
+/**
+ * @brief Decodes a single character which is not ASCII, rejecting overlong
+ * forms, surrogates, and code points beyond U+10FFFF.
+ * @return Number of octets decoded, or 0 if the sequence is not well-formed.
+ */
+static size_t DecodeSequence(unsigned char const *p, size_t n, unsigned short *q, size_t &k)
+{
+	unsigned const c = p[0];
+	if (c >= 0xC2 && c <= 0xDF)
+	{
+		if (n < 2 || (p[1] & 0xC0) != 0x80)
+			return 0;
+		q[k++] = static_cast<unsigned short>((c & 0x1F) << 6 | (p[1] & 0x3F));
+		return 2;
+	}
+	if (c >= 0xE0 && c <= 0xEF)
+	{
+		unsigned const lower = c == 0xE0 ? 0xA0 : 0x80;
+		unsigned const upper = c == 0xED ? 0x9F : 0xBF;
+		if (n < 3 || p[1] < lower || p[1] > upper || (p[2] & 0xC0) != 0x80)
+			return 0;
+		q[k++] = static_cast<unsigned short>((c & 0x0F) << 12 | (p[1] & 0x3F) << 6 | (p[2] & 0x3F));
+		return 3;
+	}
+	if (c >= 0xF0 && c <= 0xF4)
+	{
+		unsigned const lower = c == 0xF0 ? 0x90 : 0x80;
+		unsigned const upper = c == 0xF4 ? 0x8F : 0xBF;
+		if (n < 4 || p[1] < lower || p[1] > upper || (p[2] & 0xC0) != 0x80 || (p[3] & 0xC0) != 0x80)
+			return 0;
+		unsigned const u = ((c & 0x07) << 18 | (p[1] & 0x3F) << 12 | (p[2] & 0x3F) << 6 | (p[3] & 0x3F)) - 0x10000;
+		q[k++] = static_cast<unsigned short>(0xD800 | u >> 10);
+		q[k++] = static_cast<unsigned short>(0xDC00 | (u & 0x3FF));
+		return 4;
+	}
+	return 0;
+}
+
+static size_t DecodeUTF8Generic(unsigned char const *p, size_t n, unsigned short *q, size_t *written)
+{
+	size_t i = 0;
+	size_t k = 0;
+	while (i < n)
+	{
+		if (p[i] < 0x80)
+		{
+			q[k++] = p[i++];
+			continue;
+		}
+		size_t const m = DecodeSequence(p + i, n - i, q, k);
+		if (m == 0)
+			break;
+		i += m;
+	}
+	*written = k;
+	return i;
+}
+
+static size_t DecodeUTF8SSE2(unsigned char const *p, size_t n, unsigned short *q, size_t *written)
+{
+	size_t i = 0;
+	size_t k = 0;
+	__m128i const zero = _mm_setzero_si128();
+	while (i < n)
+	{
+		// Widen ASCII in blocks, and decode whatever else comes one by one
+		while (i + 16 <= n)
+		{
+			__m128i const x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+			if (_mm_movemask_epi8(x))
+				break;
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(q + k), _mm_unpacklo_epi8(x, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(q + k + 8), _mm_unpackhi_epi8(x, zero));
+			i += 16;
+			k += 16;
+		}
+		while (i < n && p[i] < 0x80)
+			q[k++] = p[i++];
+		if (i == n)
+			break;
+		size_t const m = DecodeSequence(p + i, n - i, q, k);
+		if (m == 0)
+			break;
+		i += m;
+	}
+	*written = k;
+	return i;
+}
+
+static DecodeUTF8Proc ChooseDecodeUTF8()
+{
+#ifdef _M_IX86
+	if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		return DecodeUTF8Generic;
+#endif
+	return DecodeUTF8SSE2;
+}
+
+DecodeUTF8Proc const DecodeUTF8 = ChooseDecodeUTF8();
@@ -0,0 +1,38 @@
+/**
+ * @brief The code units which the octets of a single-byte code page decode to.
+ * Like the decoders below, this depends on nothing but the standard headers
+ * and SSE2 intrinsics, so that it builds and runs on other platforms, too.
+ */
+struct DecodeTable
+{
+	unsigned short units[256];
+	bool ascii; // whether octets below 0x80 decode to themselves
+	void init();
+};
+
+/**
+ * @brief Decodes octets through a DecodeTable.
+ * @param [in] p Start of octets.
+ * @param [in] n Number of octets.
+ * @param [in] table The table to decode through, which must have been init()ed.
+ * @param [out] q Receives n code units.
+ * @return Number of code units written, which is always n.
+ */
+typedef size_t (*DecodeTableProc)(unsigned char const *p, size_t n, DecodeTable const *table, unsigned short *q);
+
+extern DecodeTableProc const DecodeSingleByte;
+
+/**
+ * @brief Decodes UTF-8 to UTF-16 for as long as it is well-formed, so that
+ * the caller can leave the rest to a converter which knows how to handle
+ * ill-formed or truncated sequences.
+ * @param [in] p Start of octets.
+ * @param [in] n Number of octets.
+ * @param [out] q Receives the code units, which never outnumber the octets.
+ * @param [out] written Receives the number of code units written.
+ * @return Number of octets decoded, which is less than n if a sequence is not
+ * well-formed.
+ */
+typedef size_t (*DecodeUTF8Proc)(unsigned char const *p, size_t n, unsigned short *q, size_t *written);
+
+extern DecodeUTF8Proc const DecodeUTF8;
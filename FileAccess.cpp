@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2015 Jochen Neubeck
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INTERNET SOFTWARE CONSORTIUM DISCLAIMS
+ * ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL INTERNET SOFTWARE
+ * CONSORTIUM BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS
+ * ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+ * SOFTWARE.
+ */
+#include <windows.h>
+#include "FileAccess.h"
+
+static __declspec(thread) FileAccess::Stats ThreadStats;
+
+/**
+ * @brief Reads count octets from offset on. The handle must not have been
+ * opened for overlapped I/O, so that the read completes before returning.
+ * @return Number of octets read, which is less than count at end of file,
+ * or 0 if the read fails.
+ */
+DWORD FileAccess::read(HANDLE handle, ULONGLONG offset, void *buffer, DWORD count)
+{
+	OVERLAPPED ov;
+	ZeroMemory(&ov, sizeof ov);
+	ov.Offset = static_cast<DWORD>(offset);
+	ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+	DWORD bytes = 0;
+	++ThreadStats.reads;
+	// Reading past end of file fails with ERROR_HANDLE_EOF given an offset
+	if (!ReadFile(handle, buffer, count, &bytes, &ov))
+	{
+		if (GetLastError() != ERROR_HANDLE_EOF)
+			++ThreadStats.failures;
+		bytes = 0;
+	}
+	ThreadStats.octets += bytes;
+	return bytes;
+}
+
+/**
+ * @brief Returns the tally of the reads which the calling thread has done.
+ */
+FileAccess::Stats const &FileAccess::stats()
+{
+	return ThreadStats;
+}
@@ -0,0 +1,17 @@
+/**
+ * @brief Reads at explicit file offsets, which leave the file pointer alone,
+ * so that any number of threads can read through the same handle without
+ * seeking it from under each other. Each thread tallies its own reads.
+ */
+class FileAccess
+{
+public:
+	struct Stats
+	{
+		ULONGLONG reads; // number of reads issued
+		ULONGLONG octets; // number of octets read
+		ULONGLONG failures; // number of reads which have failed
+	};
+	static DWORD read(HANDLE, ULONGLONG offset, void *buffer, DWORD count);
+	static Stats const &stats();
+};
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2015 Jochen Neubeck
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INTERNET SOFTWARE CONSORTIUM DISCLAIMS
+ * ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL INTERNET SOFTWARE
+ * CONSORTIUM BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS
+ * ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+ * SOFTWARE.
+ */
+#include <windows.h>
+#include "FileView.h"
+
+// Views span at least this much, starting on allocation granularity
+static SIZE_T const ViewSize = 0x400000;
+
+/**
+ * @brief Maps count octets from offset on, moving the view if need be, and
+ * creating the mapping anew if the file has grown past its extent.
+ * @return Pointer to the octets, or NULL if they can't be mapped.
+ */
+BYTE const *FileView::map(HANDLE handle, ULONGLONG offset, DWORD count)
+{
+	if (m_view && offset >= m_offset && offset + count <= m_offset + m_size)
+		return m_view + static_cast<SIZE_T>(offset - m_offset);
+	if (m_view)
+	{
+		UnmapViewOfFile(m_view);
+		m_view = NULL;
+	}
+	if (m_mapping == NULL || offset + count > m_extent)
+	{
+		if (m_mapping)
+		{
+			CloseHandle(m_mapping);
+			m_mapping = NULL;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(handle, &size) || offset + count > static_cast<ULONGLONG>(size.QuadPart))
+			return NULL;
+		m_mapping = CreateFileMapping(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_mapping == NULL)
+			return NULL;
+		m_extent = size.QuadPart;
+	}
+	ULONGLONG const base = offset & ~0xFFFFULL;
+	ULONGLONG end = base + ViewSize;
+	if (end < offset + count)
+		end = offset + count;
+	if (end > m_extent)
+		end = m_extent;
+	ULARGE_INTEGER pos;
+	pos.QuadPart = base;
+	m_view = static_cast<BYTE *>(MapViewOfFile(m_mapping, FILE_MAP_READ, pos.HighPart, pos.LowPart, static_cast<SIZE_T>(end - base)));
+	if (m_view == NULL)
+		return NULL;
+	m_offset = base;
+	m_size = static_cast<SIZE_T>(end - base);
+	return m_view + static_cast<SIZE_T>(offset - base);
+}
+
+void FileView::close()
+{
+	if (m_view)
+	{
+		UnmapViewOfFile(m_view);
+		m_view = NULL;
+	}
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = NULL;
+	}
+	m_offset = 0;
+	m_size = 0;
+	m_extent = 0;
+}
@@ -0,0 +1,22 @@
+/**
+ * @brief A read-only view of a file, which moves along as needed, through
+ * which to access octets without copying them. Pointers handed out remain
+ * valid until the next call to map() or close(). The mapping prevents the
+ * file from getting truncated, so it is to be closed once no longer in use.
+ */
+class FileView
+{
+public:
+	FileView() : m_mapping(NULL), m_view(NULL), m_offset(0), m_size(0), m_extent(0) { }
+	~FileView() { close(); }
+	BYTE const *map(HANDLE, ULONGLONG offset, DWORD count);
+	void close();
+private:
+	HANDLE m_mapping;
+	BYTE *m_view;
+	ULONGLONG m_offset; // file offset of m_view
+	SIZE_T m_size; // size of m_view
+	ULONGLONG m_extent; // file size as of when m_mapping was created
+	FileView(const FileView &);
+	FileView &operator=(const FileView &);
+};
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2015 Jochen Neubeck
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INTERNET SOFTWARE CONSORTIUM DISCLAIMS
+ * ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL INTERNET SOFTWARE
+ * CONSORTIUM BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS
+ * ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+ * SOFTWARE.
+ */
+#include <windows.h>
+#include "LineCache.h"
+
+/**
+ * @brief Drops all lines, and frees their strings.
+ */
+void LineCache::clear()
+{
+	for (UINT i = 0; i < Buckets; ++i)
+	{
+		for (UINT j = m_buckets[i]; j != None; j = m_entries[j].chain)
+			SysFreeString(m_entries[j].text);
+		m_buckets[i] = None;
+	}
+	for (UINT j = 0; j < Capacity; ++j)
+		m_entries[j].chain = j + 1 < Capacity ? j + 1 : None;
+	m_free = 0;
+	m_newest = None;
+	m_oldest = None;
+	m_chars = 0;
+}
+
+void LineCache::unlink(UINT i)
+{
+	Entry &entry = m_entries[i];
+	(entry.newer != None ? m_entries[entry.newer].older : m_newest) = entry.older;
+	(entry.older != None ? m_entries[entry.older].newer : m_oldest) = entry.newer;
+}
+
+void LineCache::link(UINT i)
+{
+	Entry &entry = m_entries[i];
+	entry.newer = None;
+	entry.older = m_newest;
+	(m_newest != None ? m_entries[m_newest].newer : m_oldest) = i;
+	m_newest = i;
+}
+
+/**
+ * @brief Drops the least recently used line.
+ */
+void LineCache::evict()
+{
+	UINT const i = m_oldest;
+	Entry &entry = m_entries[i];
+	unlink(i);
+	UINT *p = &m_buckets[bucket(entry.line)];
+	while (*p != i)
+		p = &m_entries[*p].chain;
+	*p = entry.chain;
+	m_chars -= SysStringLen(entry.text);
+	SysFreeString(entry.text);
+	entry.text = NULL;
+	entry.chain = m_free;
+	m_free = i;
+}
+
+/**
+ * @brief Looks up a line, and makes it the most recently used one.
+ * @return The line, which remains owned by the cache, or NULL if not found.
+ */
+BSTR LineCache::lookup(ULONGLONG line, UINT &width)
+{
+	UINT i = m_buckets[bucket(line)];
+	while (i != None && m_entries[i].line != line)
+		i = m_entries[i].chain;
+	if (i == None)
+		return NULL;
+	if (i != m_newest)
+	{
+		unlink(i);
+		link(i);
+	}
+	width = m_entries[i].width;
+	return m_entries[i].text;
+}
+
+/**
+ * @brief Adds a line which is not yet in the cache, and takes ownership of
+ * text unless it is too long to keep.
+ * @return Whether the cache has taken ownership of text.
+ */
+bool LineCache::insert(ULONGLONG line, BSTR text, UINT width)
+{
+	UINT const chars = SysStringLen(text);
+	if (chars > MaxChars / 4)
+		return false;
+	while (m_free == None || m_chars + chars > MaxChars)
+		evict();
+	UINT const i = m_free;
+	Entry &entry = m_entries[i];
+	m_free = entry.chain;
+	entry.line = line;
+	entry.text = text;
+	entry.width = width;
+	UINT &head = m_buckets[bucket(line)];
+	entry.chain = head;
+	head = i;
+	link(i);
+	m_chars += chars;
+	return true;
+}
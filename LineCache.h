@@ -0,0 +1,42 @@
+/**
+ * @brief A cache of lines as decoded for display, along with their widths,
+ * which holds no more than a given number of lines and characters, evicting
+ * them in order of least recent use. What the lines look like depends on the
+ * codepage, the tab width, and the delimiter, so the cache is to be cleared
+ * whenever any of these change.
+ */
+class LineCache
+{
+public:
+	static UINT const Capacity = 1024;
+	static UINT const MaxChars = 0x400000;
+	LineCache() { FillMemory(m_buckets, sizeof m_buckets, 0xFF); clear(); }
+	~LineCache() { clear(); }
+	BSTR lookup(ULONGLONG line, UINT &width);
+	bool insert(ULONGLONG line, BSTR text, UINT width);
+	void clear();
+private:
+	static UINT const None = ~0U;
+	static UINT const Buckets = 2 * Capacity;
+	struct Entry
+	{
+		ULONGLONG line;
+		BSTR text;
+		UINT width;
+		UINT chain; // next entry in the same bucket
+		UINT newer;
+		UINT older;
+	};
+	static UINT bucket(ULONGLONG line) { return static_cast<UINT>(line % Buckets); }
+	void unlink(UINT);
+	void link(UINT);
+	void evict();
+	Entry m_entries[Capacity];
+	UINT m_buckets[Buckets]; // first entry in each bucket
+	UINT m_free; // first unused entry, chained through chain
+	UINT m_newest;
+	UINT m_oldest;
+	UINT m_chars; // number of characters held
+	LineCache(const LineCache &);
+	LineCache &operator=(const LineCache &);
+};
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2015 Jochen Neubeck
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INTERNET SOFTWARE CONSORTIUM DISCLAIMS
+ * ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL INTERNET SOFTWARE
+ * CONSORTIUM BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS
+ * ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+ * SOFTWARE.
+ */
+#include <windows.h>
+#include "LineCodes.h"
+
+static BYTE *Encode(BYTE *p, UINT len)
+{
+	if (len < 0xE0)
+	{
+		*p++ = static_cast<BYTE>(len);
+	}
+	else if (len - 0xE0 < 0x1F00)
+	{
+		len -= 0xE0;
+		*p++ = static_cast<BYTE>(0xE0 + (len >> 8));
+		*p++ = static_cast<BYTE>(len);
+	}
+	else
+	{
+		*p++ = 0xFF;
+		*p++ = static_cast<BYTE>(len);
+		*p++ = static_cast<BYTE>(len >> 8);
+		*p++ = static_cast<BYTE>(len >> 16);
+		*p++ = static_cast<BYTE>(len >> 24);
+	}
+	return p;
+}
+
+static UINT Decode(BYTE const *&p)
+{
+	UINT len = *p++;
+	if (len == 0xFF)
+	{
+		len = p[0] | p[1] << 8 | p[2] << 16 | static_cast<UINT>(p[3]) << 24;
+		p += 4;
+	}
+	else if (len >= 0xE0)
+	{
+		len = (len - 0xE0 << 8 | *p++) + 0xE0;
+	}
+	return len;
+}
+
+static UINT CodeSize(UINT len)
+{
+	return len < 0xE0 ? 1 : len - 0xE0 < 0x1F00 ? 2 : LineCodes::MaxCodeSize;
+}
+
+/**
+ * @brief Determines how many octets of codes it takes to encode lines.
+ */
+UINT LineCodes::measure(LineData const *lines, UINT count)
+{
+	UINT size = 0;
+	for (UINT i = 0; i < count; ++i)
+		size += CodeSize(lines[i].len);
+	return size;
+}
+
+void LineCodes::encode(LineData const *lines, UINT count)
+{
+	BYTE *p = codes;
+	for (UINT i = 0; i < count; ++i)
+	{
+		if ((i & 15) == 0)
+		{
+			anchors[i >> 4] = lines[i].offset;
+			positions[i >> 4] = static_cast<UINT>(p - codes);
+		}
+		p = Encode(p, lines[i].len);
+	}
+}
+
+void LineCodes::decode(LineData *lines, UINT count) const
+{
+	BYTE const *p = codes;
+	ULONGLONG offset = 0;
+	for (UINT i = 0; i < count; ++i)
+	{
+		if ((i & 15) == 0)
+			offset = anchors[i >> 4];
+		lines[i].offset = offset;
+		offset += lines[i].len = Decode(p);
+	}
+}
+
+void LineCodes::locate(UINT i, LineData &linedata) const
+{
+	UINT const j = i >> 4;
+	BYTE const *p = codes + positions[j];
+	linedata.offset = anchors[j];
+	linedata.len = Decode(p);
+	for (UINT k = i & 15; k != 0; --k)
+	{
+		linedata.offset += linedata.len;
+		linedata.len = Decode(p);
+	}
+}
+
+/**
+ * @brief Retrieves the lengths of count lines from line i on.
+ */
+void LineCodes::lengths(UINT i, UINT *lengths, UINT count) const
+{
+	BYTE const *p = codes + positions[i >> 4];
+	for (UINT k = i & 15; k != 0; --k)
+		Decode(p);
+	for (UINT j = 0; j < count; ++j)
+		lengths[j] = Decode(p);
+}
+
+/**
+ * @brief Makes sure that decoding count lines stays within size octets of
+ * codes, as when they come from a file.
+ */
+bool LineCodes::validate(UINT size, UINT count) const
+{
+	BYTE const *p = codes;
+	for (UINT i = 0; i < count; ++i)
+	{
+		UINT const n = static_cast<UINT>(codes + size - p);
+		if ((i & 15) == 0 && positions[i >> 4] != size - n ||
+			n == 0 || n < (*p == 0xFF ? MaxCodeSize : *p >= 0xE0 ? 2U : 1U))
+		{
+			return false;
+		}
+		Decode(p);
+	}
+	return true;
+}
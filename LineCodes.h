@@ -0,0 +1,31 @@
+/**
+ * @brief Location of a line within a file.
+ */
+struct LineData
+{
+	ULONGLONG offset;
+	UINT len;
+};
+
+/**
+ * @brief The locations of a block of up to 0x10000 lines which follow one
+ * another, in compact shape. Holds the offset of every 16th line along with the
+ * lengths of all lines as variable length codes, so that locating a line takes
+ * decoding no more than 16 codes. Lengths below 0xE0 take one octet, lengths
+ * below 0x1FE0 take two octets, and anything longer takes an escape octet
+ * followed by the length in four octets. Allocation is up to the caller, and
+ * takes offsetof(LineCodes, codes) plus as many octets as measure() returns.
+ */
+struct LineCodes
+{
+	static UINT const MaxCodeSize = 5;
+	static UINT measure(LineData const *, UINT count);
+	void encode(LineData const *, UINT count);
+	void decode(LineData *, UINT count) const;
+	void locate(UINT i, LineData &) const;
+	void lengths(UINT i, UINT *lengths, UINT count) const;
+	bool validate(UINT size, UINT count) const;
+	ULONGLONG anchors[0x1000]; // offset of every 16th line
+	UINT positions[0x1000]; // where within codes every 16th line starts
+	BYTE codes[1]; // lengths of lines
+};
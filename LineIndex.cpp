@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2015 Jochen Neubeck
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INTERNET SOFTWARE CONSORTIUM DISCLAIMS
+ * ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL INTERNET SOFTWARE
+ * CONSORTIUM BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS
+ * ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+ * SOFTWARE.
+ */
+#include <windows.h>
+#include <stddef.h>
+#include "Arena.h"
+#include "LineCodes.h"
+#include "LineIndex.h"
+
+struct LineIndex::Block
+{
+	LineData *lines; // while the block is being filled, or else NULL
+	UINT size; // size of codes in octets
+	LineCodes coded; // absent while the block is being filled
+};
+
+/**
+ * @brief Compacts lines into a block which comes from arena, or else from
+ * CoTaskMemAlloc() if arena is NULL.
+ */
+LineIndex::Block *LineIndex::compact(LineData const *lines, UINT count, Arena *arena)
+{
+	UINT const size = LineCodes::measure(lines, count);
+	SIZE_T const header = offsetof(Block, coded) + offsetof(LineCodes, codes);
+	Block *const block = static_cast<Block *>(arena ? arena->allocate(header + size) : CoTaskMemAlloc(header + size));
+	if (block)
+	{
+		ZeroMemory(block, header);
+		block->size = size;
+		block->coded.encode(lines, count);
+	}
+	return block;
+}
+
+/**
+ * @brief Frees a block which is being filled, or has failed to compact. Other
+ * blocks belong to m_arena.
+ */
+void LineIndex::release(Block *block)
+{
+	if (block && block->lines)
+	{
+		CoTaskMemFree(block->lines);
+		CoTaskMemFree(block);
+	}
+}
+
+/**
+ * @brief Provides a block to fill, preferably by recycling m_retired.
+ */
+LineIndex::Block *LineIndex::unused()
+{
+	Block *block = m_retired;
+	if (block)
+	{
+		m_retired = NULL;
+	}
+	else if ((block = static_cast<Block *>(CoTaskMemAlloc(offsetof(Block, coded)))) != NULL)
+	{
+		block->size = 0;
+		block->lines = static_cast<LineData *>(CoTaskMemAlloc(0x10000 * sizeof(LineData)));
+		if (block->lines == NULL)
+		{
+			CoTaskMemFree(block);
+			block = NULL;
+		}
+	}
+	return block;
+}
+
+/**
+ * @brief Provides the page through which to look up block b.
+ */
+LineIndex::Block **LineIndex::getPage(UINT b)
+{
+	if (b >> 16 >= _countof(m_pages))
+		return NULL;
+	Block **&page = m_pages[b >> 16];
+	if (page == NULL)
+		page = static_cast<Block **>(CoTaskMemAlloc(0x10000 * sizeof(Block *)));
+	return page;
+}
+
+/**
+ * @brief Sets up block b to be filled, and compacts the one before.
+ */
+bool LineIndex::reserve(UINT b)
+{
+	Block **const page = getPage(b);
+	if (page == NULL)
+		return false;
+	Block *const filling = unused();
+	if (filling == NULL)
+		return false;
+	if (b != 0)
+	{
+		// Readers may still hold on to the former shape of the preceding
+		// block, so have it linger until another block gets compacted
+		Block *const full = block(b - 1);
+		if (full->lines)
+		{
+			if (Block *const compacted = compact(full->lines, 0x10000, &m_arena))
+			{
+				block(b - 1) = compacted;
+				m_retired = full;
+			}
+			else
+			{
+				m_loose = true;
+			}
+		}
+	}
+	page[b & 0xFFFF] = filling;
+	return true;
+}
+
+bool LineIndex::getEntry(ULONGLONG i, LineData &linedata) const
+{
+	Block const *const block = i < m_lines ? this->block(static_cast<UINT>(i >> 16)) : NULL;
+	if (block == NULL)
+		return false;
+	if (LineData const *const lines = block->lines)
+	{
+		linedata = lines[LOWORD(i)];
+		return true;
+	}
+	block->coded.locate(LOWORD(i), linedata);
+	return true;
+}
+
+bool LineIndex::getAt(ULONGLONG i, LineData &linedata) const
+{
+	return m_interval == 1 && getEntry(i, linedata);
+}
+
+/**
+ * @brief Locates the span to which line i belongs. In a sparse index, the
+ * length of a span saturates at LengthLimit.
+ * @param [out] first Receives the number of the first line of the span.
+ */
+bool LineIndex::getSpan(ULONGLONG i, LineData &linedata, ULONGLONG &first) const
+{
+	if (i >= m_count)
+		return false;
+	ULONGLONG const j = i / m_interval;
+	first = j * m_interval;
+	return getEntry(j, linedata);
+}
+
+/**
+ * @brief Finds the line or, in a sparse index, the span in which offset lies.
+ * @return Number of the line, or of the first line of the span.
+ */
+ULONGLONG LineIndex::find(ULONGLONG offset) const
+{
+	ULONGLONG lower = 0;
+	ULONGLONG upper = m_lines;
+	while (upper - lower > 1)
+	{
+		ULONGLONG const middle = lower + (upper - lower) / 2;
+		LineData linedata;
+		if (getEntry(middle, linedata) && linedata.offset <= offset)
+			lower = middle;
+		else
+			upper = middle;
+	}
+	return lower * m_interval;
+}
+
+/**
+ * @brief Retrieves the lengths of consecutive lines from line i on, up to the
+ * end of the block to which line i belongs.
+ * @return Number of lengths retrieved.
+ */
+UINT LineIndex::getLengths(ULONGLONG i, UINT *lengths, UINT count) const
+{
+	if (i >= m_lines || m_interval != 1)
+		return 0;
+	if (count > m_lines - i)
+		count = static_cast<UINT>(m_lines - i);
+	if (count > 0x10000U - LOWORD(i))
+		count = 0x10000U - LOWORD(i);
+	Block const *const block = this->block(static_cast<UINT>(i >> 16));
+	if (LineData const *const lines = block->lines)
+	{
+		for (UINT j = 0; j < count; ++j)
+			lengths[j] = lines[LOWORD(i) + j].len;
+	}
+	else
+	{
+		block->coded.lengths(LOWORD(i), lengths, count);
+	}
+	return count;
+}
+
+/**
+ * @brief Determines the offset just past the last line, or returns pos if
+ * there are no lines.
+ */
+ULONGLONG LineIndex::getExtent(ULONGLONG pos) const
+{
+	return m_count ? m_extent : pos;
+}
+
+/**
+ * @brief Sets the number of lines per span, which is to happen while empty.
+ */
+void LineIndex::setInterval(UINT interval)
+{
+	if (m_count == 0)
+		m_interval = interval ? interval : 1;
+}
+
+/**
+ * @brief Appends lines which follow one another from offset on.
+ * @return Number of lines appended, which is less than count if running out
+ * of memory.
+ */
+UINT LineIndex::append(ULONGLONG offset, UINT const *lengths, UINT count)
+{
+	UINT i = 0;
+	if (m_interval == 1)
+	{
+		i = appendEntries(offset, lengths, count);
+		m_count = m_lines;
+		for (UINT j = 0; j < i; ++j)
+			offset += m_last = lengths[j];
+	}
+	else while (i < count)
+	{
+		UINT const len = lengths[i];
+		if (m_phase == 0 || m_phase == m_interval)
+		{
+			if (appendEntries(offset, &len, 1) == 0)
+				break;
+			m_phase = 0;
+		}
+		else
+		{
+			extendEntry(len);
+		}
+		offset += len;
+		m_last = len;
+		++m_phase;
+		++m_count;
+		++i;
+	}
+	if (m_count)
+		m_extent = offset;
+	return i;
+}
+
+UINT LineIndex::appendEntries(ULONGLONG offset, UINT const *lengths, UINT count)
+{
+	UINT i = 0;
+	while (i < count)
+	{
+		if (LOWORD(m_lines) == 0 && !reserve(static_cast<UINT>(m_lines >> 16)))
+			break;
+		LineData *const lines = block(static_cast<UINT>(m_lines >> 16))->lines + LOWORD(m_lines);
+		UINT n = 0x10000 - LOWORD(m_lines);
+		if (n > count - i)
+			n = count - i;
+		for (UINT j = 0; j < n; ++j)
+		{
+			lines[j].offset = offset;
+			offset += lines[j].len = lengths[i + j];
+		}
+		m_lines += n;
+		i += n;
+	}
+	return i;
+}
+
+/**
+ * @brief Lengthens the last line.
+ */
+void LineIndex::extend(UINT len)
+{
+	if (m_count)
+	{
+		extendEntry(len);
+		m_last += len;
+		m_extent += len;
+	}
+}
+
+void LineIndex::extendEntry(UINT len)
+{
+	if (LineData *const lines = m_lines ? block(static_cast<UINT>(m_lines - 1 >> 16))->lines : NULL)
+	{
+		UINT &entry = lines[LOWORD(m_lines - 1)].len;
+		entry = entry < LengthLimit - len ? entry + len : LengthLimit;
+	}
+}
+
+bool LineIndex::isMatch(ULONGLONG i) const
+{
+	DWORD *const *const page = i >> 32 < _countof(m_matches) ? m_matches[i >> 32] : NULL;
+	DWORD const *const bits = page ? page[HIWORD(i)] : NULL;
+	return bits && (bits[LOWORD(i) >> 5] >> (i & 31) & 1);
+}
+
+void LineIndex::setMatch(ULONGLONG i)
+{
+	if (i >> 32 >= _countof(m_matches))
+		return;
+	DWORD **&page = m_matches[i >> 32];
+	if (page == NULL)
+	{
+		page = static_cast<DWORD **>(CoTaskMemAlloc(0x10000 * sizeof(DWORD *)));
+		if (page == NULL)
+			return;
+		ZeroMemory(page, 0x10000 * sizeof(DWORD *));
+	}
+	DWORD *&bits = page[HIWORD(i)];
+	if (bits == NULL)
+	{
+		bits = static_cast<DWORD *>(CoTaskMemAlloc(0x10000 / 8));
+		if (bits == NULL)
+			return;
+		ZeroMemory(bits, 0x10000 / 8);
+	}
+	bits[LOWORD(i) >> 5] |= 1UL << (i & 31);
+}
+
+void LineIndex::clearMatches()
+{
+	for (UINT j = 0; j < _countof(m_matches); ++j)
+	{
+		if (DWORD **const page = m_matches[j])
+		{
+			for (UINT w = 0; w < 0x10000; ++w)
+				CoTaskMemFree(page[w]);
+			CoTaskMemFree(page);
+			m_matches[j] = NULL;
+		}
+	}
+}
+
+/**
+ * @brief Reads back a block as written by write(), and appends count of its
+ * lines. Unless thaw is true, this takes count to be 0x10000.
+ */
+bool LineIndex::read(HANDLE handle, UINT count, bool thaw)
+{
+	UINT const b = static_cast<UINT>(m_lines >> 16);
+	Block **const page = getPage(b);
+	if (page == NULL)
+		return false;
+	UINT size;
+	DWORD bytes;
+	if (!ReadFile(handle, &size, sizeof size, &bytes, NULL) || bytes != sizeof size ||
+		size > 0x10000 * LineCodes::MaxCodeSize)
+	{
+		return false;
+	}
+	DWORD const rest = offsetof(LineCodes, codes) + size;
+	// A block which gets thawed is only passing through
+	SIZE_T const total = offsetof(Block, coded) + rest;
+	Block *block = static_cast<Block *>(thaw ? CoTaskMemAlloc(total) : m_arena.allocate(total));
+	if (block == NULL)
+		return false;
+	block->lines = NULL;
+	block->size = size;
+	bool const valid = ReadFile(handle, &block->coded, rest, &bytes, NULL) && bytes == rest &&
+		block->coded.validate(size, count);
+	if (valid && thaw)
+	{
+		if (Block *const filling = unused())
+		{
+			block->coded.decode(filling->lines, count);
+			CoTaskMemFree(block);
+			block = filling;
+		}
+		else
+		{
+			CoTaskMemFree(block);
+			return false;
+		}
+	}
+	if (!valid)
+	{
+		// What came from m_arena stays there until clear()
+		if (thaw)
+			CoTaskMemFree(block);
+		return false;
+	}
+	page[b & 0xFFFF] = block;
+	m_lines += count;
+	m_count = m_lines;
+	LineData linedata;
+	if (getEntry(m_lines - 1, linedata))
+	{
+		m_extent = linedata.offset + linedata.len;
+		m_last = linedata.len;
+	}
+	return true;
+}
+
+/**
+ * @brief Writes block b in compacted shape.
+ */
+bool LineIndex::write(HANDLE handle, UINT b) const
+{
+	Block const *block = this->block(b);
+	Block *compacted = NULL;
+	if (block->lines)
+	{
+		ULONGLONG const count = m_lines - (static_cast<ULONGLONG>(b) << 16);
+		block = compacted = compact(block->lines, count < 0x10000 ? static_cast<UINT>(count) : 0x10000, NULL);
+		if (block == NULL)
+			return false;
+	}
+	DWORD const rest = offsetof(LineCodes, codes) + block->size;
+	DWORD bytes;
+	bool const written =
+		WriteFile(handle, &block->size, sizeof block->size, &bytes, NULL) && bytes == sizeof block->size &&
+		WriteFile(handle, &block->coded, rest, &bytes, NULL) && bytes == rest;
+	CoTaskMemFree(compacted);
+	return written;
+}
+
+void LineIndex::clear()
+{
+	// Unless compacting has failed, only the last block may need releasing,
+	// so as not to page in the rest just to find out
+	if (m_loose)
+	{
+		for (ULONGLONG i = 0; i < m_lines; i += 0x10000)
+			release(block(static_cast<UINT>(i >> 16)));
+	}
+	else if (m_lines != 0)
+	{
+		release(block(static_cast<UINT>(m_lines - 1 >> 16)));
+	}
+	m_arena.release();
+	for (UINT j = 0; j < _countof(m_pages); ++j)
+	{
+		CoTaskMemFree(m_pages[j]);
+		m_pages[j] = NULL;
+	}
+	release(m_retired);
+	m_retired = NULL;
+	clearMatches();
+	m_lines = 0;
+	m_count = 0;
+	m_extent = 0;
+	m_last = 0;
+	m_phase = 0;
+	m_loose = false;
+}
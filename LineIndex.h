@@ -0,0 +1,66 @@
+/**
+ * @brief An index of the lines of a file, which keeps their locations in
+ * compressed form. Lines come in blocks of 0x10000, which hold plain LineData
+ * while being filled, and get compacted once the next block starts. Compacted
+ * blocks hold LineCodes, so that locating a line involves decoding no more
+ * than 16 codes. Blocks are looked up through pages of 0x10000, of which
+ * only files of more than 4G lines need more than one. Which lines match a
+ * search lives in a bitset of its own, which is paged the same way. Compacted blocks come from an arena,
+ * which gives them back all at once.
+ *
+ * With an interval other than 1, the index goes sparse and records only spans
+ * of as many lines, leaving it to the caller to rescan them as needed.
+ */
+class LineIndex
+{
+public:
+	static UINT const LengthLimit = 0xFFFFFFFF;
+	LineIndex()
+		: m_retired(NULL), m_lines(0), m_count(0), m_extent(0), m_last(0), m_phase(0), m_interval(1), m_loose(false)
+	{
+		ZeroMemory(m_pages, sizeof m_pages);
+		ZeroMemory(m_matches, sizeof m_matches);
+	}
+	~LineIndex() { clear(); }
+	ULONGLONG size() const { return m_count; }
+	UINT interval() const { return m_interval; }
+	void setInterval(UINT);
+	UINT lastLength() const { return m_last; }
+	bool getAt(ULONGLONG, LineData &) const;
+	bool getSpan(ULONGLONG, LineData &, ULONGLONG &first) const;
+	ULONGLONG find(ULONGLONG offset) const;
+	UINT getLengths(ULONGLONG, UINT *lengths, UINT count) const;
+	ULONGLONG getExtent(ULONGLONG) const;
+	UINT append(ULONGLONG offset, UINT const *lengths, UINT count);
+	void extend(UINT len);
+	bool isMatch(ULONGLONG) const;
+	void setMatch(ULONGLONG);
+	void clearMatches();
+	bool read(HANDLE, UINT count, bool thaw);
+	bool write(HANDLE, UINT) const;
+	void clear();
+private:
+	struct Block;
+	static Block *compact(LineData const *, UINT count, Arena *);
+	static void release(Block *);
+	Block *unused();
+	Block *&block(UINT b) const { return m_pages[b >> 16][b & 0xFFFF]; }
+	Block **getPage(UINT);
+	bool reserve(UINT);
+	UINT appendEntries(ULONGLONG offset, UINT const *lengths, UINT count);
+	void extendEntry(UINT len);
+	bool getEntry(ULONGLONG, LineData &) const;
+	Block **m_pages[0x100];
+	DWORD **m_matches[0x100];
+	Block *m_retired; // most recently compacted block in its former shape
+	ULONGLONG m_lines; // number of entries, which are spans if sparse
+	ULONGLONG m_count; // number of lines
+	ULONGLONG m_extent; // offset just past the last line
+	UINT m_last; // length of the last line
+	UINT m_phase; // number of lines in the last span
+	UINT m_interval; // number of lines per span
+	bool m_loose; // whether blocks other than the last have failed to compact
+	Arena m_arena;
+	LineIndex(const LineIndex &);
+	LineIndex &operator=(const LineIndex &);
+};
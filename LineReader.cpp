@@ -15,13 +15,488 @@
  * SOFTWARE.
  */
 #include <windows.h>
-#include <wchar.h>
+#include "FileAccess.h"
 #include "LineReader.h"
+#include "LineStats.h"
+#include "Scanner.h"
+
+#ifdef _WIN64
+static SIZE_T const ViewSize = 0x4000000;
+#else
+static SIZE_T const ViewSize = 0x400000;
+#endif
+
+// PrefetchVirtualMemory() is available as of Windows 8, so look it up dynamically
+struct MemoryRange { LPVOID VirtualAddress; SIZE_T NumberOfBytes; };
+static BOOL (WINAPI *const PrefetchVirtualMemoryProc)(HANDLE, ULONG_PTR, MemoryRange *, ULONG) =
+	reinterpret_cast<BOOL (WINAPI *)(HANDLE, ULONG_PTR, MemoryRange *, ULONG)>(
+		GetProcAddress(GetModuleHandle(TEXT("KERNEL32")), "PrefetchVirtualMemory"));
+
+// ReOpenFile() is available as of Windows Vista, so look it up dynamically
+static HANDLE (WINAPI *const ReOpenFileProc)(HANDLE, DWORD, DWORD, DWORD) =
+	reinterpret_cast<HANDLE (WINAPI *)(HANDLE, DWORD, DWORD, DWORD)>(
+		GetProcAddress(GetModuleHandle(TEXT("KERNEL32")), "ReOpenFile"));
+
+// Buffers which a thread of their own fills while the reader scans the ones
+// filled before. The thread pauses at limit, and posts an empty buffer when
+// it does so or reaches end of file. Given an overlapped handle, the thread
+// keeps a read in flight for every buffer which the reader doesn't hold.
+struct LineReader::Pipeline
+{
+	struct Buffer
+	{
+		ULONGLONG offset;
+		DWORD bytes;
+		BYTE *data;
+		OVERLAPPED ov;
+		bool inflight;
+	};
+	HANDLE handle;
+	HANDLE thread;
+	HANDLE filled; // semaphore which counts buffers ready to be scanned
+	HANDLE empty; // semaphore which counts buffers ready to be filled
+	ULONGLONG offset; // file offset at which the thread goes on reading
+	ULONGLONG limit; // file offset at which the thread pauses
+	bool volatile stop;
+	bool exhausted; // whether the thread has reached end of file
+	DWORD size;
+	UINT count;
+	UINT filling; // index of the buffer which the thread fills next
+	UINT taking; // index of the buffer which the reader takes next
+	Buffer *current; // buffer which the reader scans
+	Buffer buffers[1];
+};
+
+LineReader::~LineReader()
+{
+	if (m_pipeline)
+	{
+		stopReadingAhead();
+		CloseHandle(m_pipeline->filled);
+		CloseHandle(m_pipeline->empty);
+		VirtualFree(m_pipeline->buffers[0].data, 0, MEM_RELEASE);
+		HeapFree(GetProcessHeap(), 0, m_pipeline);
+	}
+	if (m_view)
+		UnmapViewOfFile(m_view);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+}
+
+/**
+ * @brief Moves on to where reading is to continue, discarding any data which
+ * has been read ahead.
+ */
+bool LineReader::seek(ULONGLONG offset)
+{
+	m_offset = offset;
+	m_index = 0;
+	m_ahead = 0;
+	m_scanned = -1;
+	m_kept = 0;
+	m_lower = 0;
+	if (m_pipeline)
+	{
+		stopReadingAhead();
+		m_pipeline->offset = offset;
+	}
+	if (m_mapping)
+	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		m_offset -= offset % si.dwAllocationGranularity;
+		m_skip = static_cast<size_t>(offset - m_offset);
+	}
+	return true;
+}
+
+/**
+ * @brief Have subsequent reads scan through a sliding window of mapped views
+ * rather than copy the data into m_buffer. Must be called prior to reading.
+ * @return Whether the reader now uses mapped views.
+ */
+bool LineReader::mapViews()
+{
+	LARGE_INTEGER size;
+	ULONGLONG const pos = m_offset;
+	if (GetFileSizeEx(m_handle, &size) && size.QuadPart != 0 && pos < static_cast<ULONGLONG>(size.QuadPart))
+	{
+		m_mapping = CreateFileMapping(m_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	if (m_mapping == NULL)
+		return false;
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	m_size = size.QuadPart;
+	m_offset = pos - pos % si.dwAllocationGranularity;
+	m_skip = static_cast<size_t>(pos - m_offset);
+	return true;
+}
+
+/**
+ * @brief Have lines end with a sequence of octets rather than a single code
+ * unit, of which the last one is to equal the code unit passed to the read
+ * methods. Must be called prior to reading.
+ * @return Whether the delimiter fits in MaxDelimiter octets.
+ */
+bool LineReader::setDelimiter(void const *delimiter, size_t length)
+{
+	if (length == 0 || length > MaxDelimiter)
+		return false;
+	memcpy(m_delimiter, delimiter, length);
+	m_length = length;
+	return true;
+}
+
+/**
+ * @brief Have subsequent reads scan through buffers which a thread of its own
+ * fills ahead of time, so that reading overlaps with scanning. Must be called
+ * prior to reading.
+ * @param [in] size Size of each buffer in bytes.
+ * @param [in] count Number of buffers.
+ * @return Whether the reader now reads ahead.
+ */
+bool LineReader::readAhead(DWORD size, UINT count)
+{
+	if (m_mapping || m_pipeline || count < 2 || size < sizeof m_buffer)
+		return false;
+	size &= ~(sizeof m_buffer - 1);
+	BYTE *const data = static_cast<BYTE *>(VirtualAlloc(NULL, static_cast<SIZE_T>(size) * count, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+	if (data == NULL)
+		return false;
+	Pipeline *const p = static_cast<Pipeline *>(HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
+		offsetof(Pipeline, buffers) + count * sizeof(Pipeline::Buffer)));
+	if (p == NULL)
+	{
+		VirtualFree(data, 0, MEM_RELEASE);
+		return false;
+	}
+	p->handle = m_handle;
+	p->offset = m_offset;
+	p->size = size;
+	p->count = count;
+	for (UINT i = 0; i < count; ++i)
+		p->buffers[i].data = data + static_cast<SIZE_T>(size) * i;
+	m_pipeline = p;
+	stopReadingAhead();
+	if (p->filled == NULL || p->empty == NULL)
+	{
+		if (p->filled)
+			CloseHandle(p->filled);
+		if (p->empty)
+			CloseHandle(p->empty);
+		VirtualFree(data, 0, MEM_RELEASE);
+		HeapFree(GetProcessHeap(), 0, p);
+		m_pipeline = NULL;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Terminates the thread which reads ahead, if any, and discards any
+ * data it has read, so that it starts over from scratch once needed again.
+ */
+void LineReader::stopReadingAhead()
+{
+	Pipeline *const p = m_pipeline;
+	if (p->thread)
+	{
+		p->stop = true;
+		ReleaseSemaphore(p->empty, 1, NULL);
+		WaitForSingleObject(p->thread, INFINITE);
+		CloseHandle(p->thread);
+		p->thread = NULL;
+	}
+	if (p->filled)
+		CloseHandle(p->filled);
+	if (p->empty)
+		CloseHandle(p->empty);
+	p->filled = CreateSemaphore(NULL, 0, p->count, NULL);
+	p->empty = CreateSemaphore(NULL, p->count, p->count, NULL);
+	p->stop = false;
+	p->exhausted = false;
+	p->filling = 0;
+	p->taking = 0;
+	p->current = NULL;
+}
+
+DWORD WINAPI LineReader::ReadAheadThread(LPVOID pv)
+{
+	Pipeline *const p = static_cast<Pipeline *>(pv);
+	HANDLE const handle = ReOpenFileProc ? ReOpenFileProc(p->handle, FILE_GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN) :
+		INVALID_HANDLE_VALUE;
+	if (handle != INVALID_HANDLE_VALUE)
+	{
+		fillOverlapped(p, handle);
+		CloseHandle(handle);
+	}
+	else
+	{
+		fillSynchronously(p);
+	}
+	return 0;
+}
+
+void LineReader::fillSynchronously(Pipeline *p)
+{
+	for (;;)
+	{
+		WaitForSingleObject(p->empty, INFINITE);
+		if (p->stop)
+			break;
+		Pipeline::Buffer &buffer = p->buffers[p->filling++ % p->count];
+		ULONGLONG const ahead = p->limit > p->offset ? p->limit - p->offset : 0;
+		DWORD const size = ahead < p->size ? static_cast<DWORD>(ahead) : p->size;
+		buffer.offset = p->offset;
+		buffer.bytes = size != 0 ? FileAccess::read(p->handle, p->offset, buffer.data, size) : 0;
+		p->offset += buffer.bytes;
+		if (buffer.bytes == 0)
+			p->exhausted = size != 0;
+		ReleaseSemaphore(p->filled, 1, NULL);
+		if (buffer.bytes == 0)
+			break;
+	}
+}
+
+void LineReader::fillOverlapped(Pipeline *p, HANDLE handle)
+{
+	for (UINT i = 0; i < p->count; ++i)
+	{
+		ZeroMemory(&p->buffers[i].ov, sizeof p->buffers[i].ov);
+		p->buffers[i].ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		p->buffers[i].inflight = false;
+	}
+	UINT pending = 0;
+	bool paused = false;
+	while (!p->stop)
+	{
+		// Issue a read for every buffer which has been given back, but block
+		// only if there is nothing else to wait for
+		while (!paused && pending < p->count &&
+			WaitForSingleObject(p->empty, pending ? 0 : INFINITE) == WAIT_OBJECT_0)
+		{
+			Pipeline::Buffer &buffer = p->buffers[(p->filling + pending++) % p->count];
+			ULONGLONG const ahead = p->limit > p->offset ? p->limit - p->offset : 0;
+			DWORD const size = ahead < p->size ? static_cast<DWORD>(ahead) : p->size;
+			buffer.offset = p->offset;
+			buffer.bytes = size;
+			buffer.ov.Offset = static_cast<DWORD>(p->offset);
+			buffer.ov.OffsetHigh = static_cast<DWORD>(p->offset >> 32);
+			buffer.inflight = size != 0 && buffer.ov.hEvent != NULL &&
+				(ReadFile(handle, buffer.data, size, NULL, &buffer.ov) || GetLastError() == ERROR_IO_PENDING);
+			p->offset += size;
+			if (size == 0 || p->stop)
+				paused = true;
+		}
+		if (p->stop || pending == 0)
+			break;
+		// Hand over the oldest buffer once its read has completed
+		Pipeline::Buffer &buffer = p->buffers[p->filling++ % p->count];
+		--pending;
+		DWORD const size = buffer.bytes;
+		if (!buffer.inflight || !GetOverlappedResult(handle, &buffer.ov, &buffer.bytes, TRUE))
+			buffer.bytes = 0;
+		buffer.inflight = false;
+		if (buffer.bytes == 0)
+			p->exhausted = size != 0;
+		ReleaseSemaphore(p->filled, 1, NULL);
+		if (buffer.bytes == 0)
+			break;
+	}
+	// Give back the buffers whose reads are still in flight
+	CancelIo(handle);
+	while (pending != 0)
+	{
+		Pipeline::Buffer &buffer = p->buffers[p->filling++ % p->count];
+		--pending;
+		DWORD bytes;
+		if (buffer.inflight)
+			GetOverlappedResult(handle, &buffer.ov, &bytes, TRUE);
+		buffer.inflight = false;
+		ReleaseSemaphore(p->empty, 1, NULL);
+	}
+	for (UINT i = 0; i < p->count; ++i)
+	{
+		if (p->buffers[i].ov.hEvent)
+			CloseHandle(p->buffers[i].ov.hEvent);
+	}
+}
+
+size_t LineReader::takeChunk()
+{
+	Pipeline *const p = m_pipeline;
+	for (;;)
+	{
+		if (Pipeline::Buffer *const buffer = p->current)
+		{
+			if (m_index < buffer->bytes)
+			{
+				ULONGLONG const pos = buffer->offset + m_index;
+				ULONGLONG const ahead = m_end > pos ? m_end - pos : 0;
+				size_t const rest = buffer->bytes - m_index;
+				return ahead < rest ? static_cast<size_t>(ahead) : rest;
+			}
+			if (buffer->bytes == 0)
+			{
+				if (p->exhausted || buffer->offset >= m_end)
+					return 0;
+				// Have a new thread resume where the former one has paused
+				WaitForSingleObject(p->thread, INFINITE);
+				CloseHandle(p->thread);
+				p->thread = NULL;
+			}
+			keepHistory();
+			p->current = NULL;
+			ReleaseSemaphore(p->empty, 1, NULL);
+		}
+		if (p->thread == NULL)
+		{
+			p->limit = m_end;
+			p->thread = CreateThread(NULL, 0, ReadAheadThread, p, 0, NULL);
+			if (p->thread == NULL)
+				return 0;
+		}
+		WaitForSingleObject(p->filled, INFINITE);
+		p->current = &p->buffers[p->taking++ % p->count];
+		m_chunk = p->current->data;
+		m_index = 0;
+	}
+}
+
+size_t LineReader::mapChunk()
+{
+	if (m_view)
+	{
+		UnmapViewOfFile(m_view);
+		m_view = NULL;
+	}
+	ULONGLONG const upper = m_end < m_size ? m_end : m_size;
+	ULONGLONG const ahead = upper > m_offset ? upper - m_offset : 0;
+	SIZE_T const size = ahead < ViewSize ? static_cast<SIZE_T>(ahead) : ViewSize;
+	if (size == 0)
+		return 0;
+	ULARGE_INTEGER offset;
+	offset.QuadPart = m_offset;
+	m_view = static_cast<BYTE *>(MapViewOfFile(m_mapping, FILE_MAP_READ, offset.HighPart, offset.LowPart, size));
+	if (m_view == NULL)
+		return 0;
+	// Let the system bring in the whole view with large reads while we scan
+	if (PrefetchVirtualMemoryProc)
+	{
+		MemoryRange range = { m_view, size };
+		PrefetchVirtualMemoryProc(GetCurrentProcess(), 1, &range, 0);
+	}
+	m_chunk = m_view;
+	m_offset += size;
+	m_index = m_skip;
+	m_skip = 0;
+	// Octets before where reading has started don't count for a delimiter
+	if (m_lower < static_cast<ptrdiff_t>(m_index))
+		m_lower = m_index;
+	return size - m_index;
+}
+
+size_t LineReader::readChunk()
+{
+	m_scanned = -1;
+	if (m_pipeline)
+	{
+		m_ahead = takeChunk();
+	}
+	else if (m_mapping)
+	{
+		keepHistory();
+		m_index = 0;
+		m_ahead = mapChunk();
+	}
+	else
+	{
+		keepHistory();
+		m_index = 0;
+		ULONGLONG const ahead = m_end > m_offset ? m_end - m_offset : 0;
+		DWORD const size = ahead < sizeof m_buffer ? static_cast<DWORD>(ahead) : sizeof m_buffer;
+		m_ahead = size != 0 ? FileAccess::read(m_handle, m_offset, m_buffer, size) : 0;
+		m_offset += m_ahead;
+	}
+	return m_ahead;
+}
+
+/**
+ * @brief Scans up to ScanStride octets from m_index on for a delimiter.
+ * @param [in] key The delimiter, which is a 16-bit code unit if WideKey is set.
+ */
+void LineReader::scan(int key)
+{
+	C_ASSERT(ScanStride <= _countof(m_offsets));
+	m_basis = m_index;
+	m_extent = m_ahead < ScanStride ? m_ahead : ScanStride;
+	m_found = key & WideKey ?
+		ScanWords(m_chunk + m_index, m_extent, static_cast<WORD>(key), m_offsets) :
+		ScanOctets(m_chunk + m_index, m_extent, static_cast<BYTE>(key), m_offsets);
+	m_next = 0;
+	m_scanned = key;
+	// With a longer delimiter, what has been found so far are only candidates
+	// for its last code unit, so keep those which complete the delimiter, and
+	// don't let delimiters overlap
+	if (m_length > (key & WideKey ? 2U : 1U))
+	{
+		size_t found = 0;
+		for (size_t i = 0; i < m_found; ++i)
+		{
+			ptrdiff_t const upper = static_cast<ptrdiff_t>(m_basis + m_offsets[i]);
+			ptrdiff_t const lower = upper - static_cast<ptrdiff_t>(m_length);
+			if (lower >= m_lower && matchDelimiter(lower))
+			{
+				m_offsets[found++] = m_offsets[i];
+				m_lower = upper;
+			}
+		}
+		m_found = found;
+	}
+}
+
+/**
+ * @brief Checks whether the delimiter occurs at chunk offset lower, which may
+ * be negative to refer to m_history.
+ */
+bool LineReader::matchDelimiter(ptrdiff_t lower) const
+{
+	if (lower < -static_cast<ptrdiff_t>(m_kept))
+		return false;
+	for (size_t i = 0; i < m_length; ++i)
+	{
+		ptrdiff_t const j = lower + static_cast<ptrdiff_t>(i);
+		BYTE const c = j < 0 ? m_history[m_kept + j] : m_chunk[j];
+		if (c != m_delimiter[i])
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Remembers the octets up to m_index, at which the next chunk picks
+ * up, as far as needed to find a delimiter which spans both chunks.
+ */
+void LineReader::keepHistory()
+{
+	if (m_length < 2)
+		return;
+	size_t const want = m_length - 1;
+	size_t const fresh = m_index < want ? m_index : want;
+	size_t const stale = want - fresh < m_kept ? want - fresh : m_kept;
+	memmove(m_history, m_history + m_kept - stale, stale);
+	memcpy(m_history + stale, m_chunk + m_index - fresh, fresh);
+	m_kept = stale + fresh;
+	m_lower -= static_cast<ptrdiff_t>(m_index);
+	if (m_lower < -static_cast<ptrdiff_t>(MaxDelimiter))
+		m_lower = -static_cast<ptrdiff_t>(MaxDelimiter);
+}
 
 size_t LineReader::readBom(Encoding &encoding, Encoding guess)
 {
-	DWORD bytes;
-	m_ahead = ReadFile(m_handle, m_chunk, sizeof m_chunk, &bytes, NULL) ? bytes : 0;
+	readChunk();
 	if (m_ahead >= 2)
 	{
 		if (m_chunk[0] == 0xFF && m_chunk[1] == 0xFE || m_chunk[0] == 0xFE && m_chunk[1] == 0xFF)
@@ -43,65 +518,118 @@ size_t LineReader::readBom(Encoding &encoding, Encoding guess)
 
 size_t LineReader::readLineAnsi(size_t limit, char eol)
 {
+	return readLine(limit, static_cast<BYTE>(eol));
+}
+
+size_t LineReader::readLineWide(size_t limit, wchar_t eol)
+{
+	return readLine(limit, WideKey | static_cast<WORD>(eol));
+}
+
+size_t LineReader::readLine(size_t limit, int key)
+{
+	// Don't let a line end in the middle of a code unit
+	if (key & WideKey)
+		limit &= ~static_cast<size_t>(1);
 	size_t count = 0;
+	bool delimited = false;
 	do 
 	{
+		if (m_scanned != key || m_index >= m_basis + m_extent)
+			scan(key);
+		// Skip delimiters which have been consumed through other methods
+		while (m_next < m_found && m_basis + m_offsets[m_next] <= m_index)
+			++m_next;
 		size_t n = count;
 		size_t delta = limit - n;
-		if (delta > m_ahead)
-			delta = m_ahead;
+		size_t const extent = m_basis + m_extent - m_index;
+		if (delta > extent)
+			delta = extent;
 		count = n + delta;
-		BYTE *lower = m_chunk + m_index;
-		if (BYTE *upper = static_cast<BYTE *>(memchr(m_chunk + m_index, eol, delta)))
+		if (m_next < m_found)
 		{
-			++upper;
-			delta = upper - lower;
+			size_t const upper = m_basis + m_offsets[m_next] - m_index;
+			if (upper <= delta)
+			{
+				++m_next;
+				delta = upper;
+				limit = n + delta;
+				count = limit; // causes loop termination
+				delimited = true;
+			}
+		}
+		// Hold back an octet which ends the data amid a code unit, so that
+		// reading resumes at a code unit boundary once the rest has arrived
+		if ((key & WideKey) && !delimited && delta == m_ahead && (delta & 1))
+		{
+			--delta;
 			limit = n + delta;
 			count = limit; // causes loop termination
 		}
+		if (m_stats)
+			m_stats->feed(m_chunk + m_index, delta);
+		m_index += delta;
+		m_ahead -= delta;
 		if (count == limit)
-		{
-			m_index += delta;
-			m_ahead -= delta;
 			break;
-		}
-		m_index = 0;
-		DWORD bytes;
-		m_ahead = ReadFile(m_handle, m_chunk, sizeof m_chunk, &bytes, NULL) ? bytes : 0;
-	} while (m_ahead != 0);
+	} while (m_ahead != 0 || readChunk() != 0);
+	if (count != 0)
+		m_delimited = delimited;
+	if (delimited && m_stats)
+		m_stats->endLine();
 	return count;
 }
 
-size_t LineReader::readLineWide(size_t limit, wchar_t eol)
+/**
+ * @brief Reads up to count lines at once and stores their lengths.
+ * @return Number of lines read, which is less than count only at end of file.
+ */
+size_t LineReader::readLinesAnsi(UINT *lengths, size_t count, size_t limit, char eol)
 {
-	size_t count = 0;
-	do 
+	return readLines(lengths, count, limit, static_cast<BYTE>(eol));
+}
+
+size_t LineReader::readLinesWide(UINT *lengths, size_t count, size_t limit, wchar_t eol)
+{
+	return readLines(lengths, count, limit & ~static_cast<size_t>(1), WideKey | static_cast<WORD>(eol));
+}
+
+size_t LineReader::readLines(UINT *lengths, size_t count, size_t limit, int key)
+{
+	size_t i = 0;
+	while (i < count)
 	{
-		size_t n = count;
-		size_t delta = limit - n;
-		if (delta > m_ahead)
-			delta = m_ahead;
-		count = n + delta;
-		BYTE *lower = m_chunk + m_index;
-		if (BYTE *upper = reinterpret_cast<BYTE *>(wmemchr(
-			reinterpret_cast<wchar_t *>(m_chunk + m_index), eol, delta / sizeof(wchar_t))))
+		// Serve lines from the current batch of delimiters as long as possible
+		if (m_scanned == key && m_index < m_basis + m_extent)
 		{
-			upper += sizeof(wchar_t);
-			delta = upper - lower;
-			limit = n + delta;
-			count = limit; // causes loop termination
+			while (m_next < m_found && m_basis + m_offsets[m_next] <= m_index)
+				++m_next;
+			while (i < count && m_next < m_found)
+			{
+				size_t const len = m_basis + m_offsets[m_next] - m_index;
+				if (len > limit)
+					break;
+				lengths[i++] = static_cast<UINT>(len);
+				if (m_stats)
+				{
+					m_stats->feed(m_chunk + m_index, len);
+					m_stats->endLine();
+				}
+				m_index += len;
+				m_ahead -= len;
+				++m_next;
+				m_delimited = true;
+			}
+			if (i == count)
+				break;
 		}
-		if (count == limit)
-		{
-			m_index += delta;
-			m_ahead -= delta;
+		// Let readLine() deal with lines which cross chunk boundaries
+		size_t const len = readLine(limit, key);
+		if (len == 0)
 			break;
-		}
-		m_index = 0;
-		DWORD bytes;
-		m_ahead = ReadFile(m_handle, m_chunk, sizeof m_chunk, &bytes, NULL) ? bytes : 0;
-	} while (m_ahead != 0);
-	return count;
+		lengths[i++] = static_cast<UINT>(len);
+	}
+	return i;
 }
 
 size_t LineReader::readLineAnsi(char *buffer, size_t limit, char eol)
@@ -127,10 +655,7 @@ size_t LineReader::readLineAnsi(char *buffer, size_t limit, char eol)
 			m_ahead -= delta;
 			break;
 		}
-		m_index = 0;
-		DWORD bytes;
-		m_ahead = ReadFile(m_handle, m_chunk, sizeof m_chunk, &bytes, NULL) ? bytes : 0;
-	} while (m_ahead != 0);
+	} while (readChunk() != 0);
 	return count;
 }
 
@@ -1,3 +1,5 @@
+class LineStats;
+
 /**
  * @brief A reader that reads textual data line by line from a file.
  */
@@ -5,20 +7,68 @@ class LineReader
 {
 public:
 	enum Encoding { NONE = 0x00, GUESS = 0x01, ANSI = 0xEE, UTF8 = 0xEF, UCS2BE = 0xFE, UCS2LE = 0xFF };
+	static size_t const MaxDelimiter = 32;
 	LineReader(HANDLE handle)
-		: m_handle(handle), m_index(0), m_ahead(0)
+		: m_handle(handle), m_mapping(NULL), m_view(NULL), m_pipeline(NULL), m_offset(0), m_size(0), m_end(~0ULL), m_skip(0)
+		, m_chunk(m_buffer), m_index(0), m_ahead(0), m_basis(0), m_extent(0), m_found(0), m_next(0), m_scanned(-1), m_delimited(false)
+		, m_length(1), m_kept(0), m_lower(0), m_stats(NULL)
 	{
 	}
+	~LineReader();
+	bool seek(ULONGLONG offset);
+	bool mapViews();
+	bool readAhead(DWORD size, UINT count = 2);
+	bool setDelimiter(void const *, size_t);
+	void setEnd(ULONGLONG end = ~0ULL) { m_end = end; }
+	void tally(LineStats *stats) { m_stats = stats; }
+	bool lastLineDelimited() const { return m_delimited; }
 	size_t readBom(Encoding &, Encoding guess = NONE);
 	size_t readLineAnsi(size_t limit, char eol = '\n');
 	size_t readLineAnsi(char *buffer, size_t limit, char eol = '\n');
 	size_t peekLineAnsi(size_t index, char *buffer, size_t limit, char eol = '\n');
 	size_t readLineWide(size_t limit, wchar_t eol = L'\n');
+	size_t readLinesAnsi(UINT *lengths, size_t count, size_t limit, char eol = '\n');
+	size_t readLinesWide(UINT *lengths, size_t count, size_t limit, wchar_t eol = L'\n');
 private:
+	struct Pipeline;
+	static int const WideKey = 0x10000;
+	size_t readChunk();
+	size_t mapChunk();
+	size_t takeChunk();
+	void stopReadingAhead();
+	static DWORD WINAPI ReadAheadThread(LPVOID);
+	static void fillSynchronously(Pipeline *);
+	static void fillOverlapped(Pipeline *, HANDLE);
+	void scan(int key);
+	void keepHistory();
+	bool matchDelimiter(ptrdiff_t) const;
+	size_t readLine(size_t limit, int key);
+	size_t readLines(UINT *lengths, size_t count, size_t limit, int key);
 	HANDLE const m_handle;
+	HANDLE m_mapping;
+	BYTE *m_view;
+	Pipeline *m_pipeline;
+	ULONGLONG m_offset; // file offset of next chunk to read or view to map
+	ULONGLONG m_size; // file size as of when the mapping was created
+	ULONGLONG m_end; // file offset at which to stop reading
+	size_t m_skip; // offset within first view at which to start reading
+	BYTE *m_chunk; // either m_buffer or m_view
 	size_t m_index;
 	size_t m_ahead;
-	BYTE m_chunk[0x8000];
-	LineReader &LineReader::operator=(const LineReader &);
+	size_t m_basis; // chunk offset to which m_offsets are relative
+	size_t m_extent; // number of octets covered by m_offsets
+	size_t m_found; // number of valid entries in m_offsets
+	size_t m_next; // index of next entry in m_offsets to consume
+	int m_scanned; // delimiter to which m_offsets refers, or -1 if none, with WideKey set if 16 bits
+	bool m_delimited; // whether the last line read ended in a delimiter
+	size_t m_length; // length of the delimiter, which is a single code unit unless greater
+	size_t m_kept; // number of octets in m_history
+	ptrdiff_t m_lower; // chunk offset before which the next delimiter must not start
+	BYTE m_delimiter[MaxDelimiter]; // the delimiter if longer than a single code unit
+	BYTE m_history[MaxDelimiter]; // octets which precede the current chunk
+	LineStats *m_stats; // receives the octets of lines as they are read, unless NULL
+	WORD m_offsets[0x8000]; // offsets just past each delimiter found
+	BYTE m_buffer[0x8000];
+	LineReader(const LineReader &);
+	LineReader &operator=(const LineReader &);
 };
-
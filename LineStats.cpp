@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2015 Jochen Neubeck
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INTERNET SOFTWARE CONSORTIUM DISCLAIMS
+ * ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL INTERNET SOFTWARE
+ * CONSORTIUM BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS
+ * ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+ * SOFTWARE.
+ */
+#include <windows.h>
+#include <intrin.h>
+#include "LineReader.h"
+#include "LineStats.h"
+#include "Scanner.h"
+
+void LineStats::clear()
+{
+	ZeroMemory(&m_totals, sizeof m_totals);
+	ZeroMemory(&m_line, sizeof m_line);
+	ZeroMemory(&m_last, sizeof m_last);
+	ZeroMemory(m_columns, sizeof m_columns);
+	m_run = 0;
+	m_crpending = false;
+	m_wide = false;
+	m_bigendian = false;
+	m_utf8 = false;
+	m_odd = -1;
+}
+
+void LineStats::setEncoding(LineReader::Encoding encoding)
+{
+	m_wide = encoding == LineReader::UCS2LE || encoding == LineReader::UCS2BE;
+	m_bigendian = encoding == LineReader::UCS2BE;
+	m_utf8 = encoding == LineReader::UTF8;
+}
+
+/**
+ * @brief Advances the columns of the current line to the next tab stop for
+ * each of the tab widths, as ExpandTabs() does.
+ */
+void LineStats::tab()
+{
+	for (UINT i = 0; i < TabWidths; ++i)
+		m_columns[i] = (m_columns[i] + m_run | (1U << i) - 1) + 1;
+	m_run = 0;
+}
+
+void LineStats::feedUnit(UINT c)
+{
+	if (m_crpending)
+	{
+		m_crpending = false;
+		if (c == '\n')
+		{
+			++m_line.crlf;
+			++m_run;
+			return;
+		}
+		++m_line.cr;
+	}
+	switch (c)
+	{
+	case '\t':
+		tab();
+		return;
+	case '\n':
+		++m_line.lf;
+		break;
+	case '\r':
+		m_crpending = true;
+		break;
+	default:
+		if (c >= 0x80)
+			m_line.nonascii = true;
+		break;
+	}
+	++m_run;
+}
+
+/**
+ * @brief Accounts for octets which belong to the current line.
+ */
+void LineStats::feed(BYTE const *p, size_t n)
+{
+	m_line.octets += n;
+	BYTE const *const upper = p + n;
+	if (m_wide)
+	{
+		if (m_odd >= 0 && p < upper)
+		{
+			BYTE const octets[2] = { static_cast<BYTE>(m_odd), *p++ };
+			feedUnit(m_bigendian ? octets[0] << 8 | octets[1] : octets[1] << 8 | octets[0]);
+			m_odd = -1;
+		}
+		while (upper - p >= 2)
+		{
+			feedUnit(m_bigendian ? p[0] << 8 | p[1] : p[1] << 8 | p[0]);
+			p += 2;
+		}
+		if (p < upper)
+			m_odd = *p;
+	}
+	else
+	{
+		while (p < upper)
+		{
+			// Skip through the octets which just take a column each in bulk
+			if (!m_crpending)
+			{
+				size_t const k = SkipPlain(p, upper - p);
+				m_run += static_cast<UINT>(k);
+				p += k;
+				if (p == upper)
+					break;
+			}
+			BYTE const c = *p++;
+			if (c < 0x80)
+			{
+				feedUnit(c);
+			}
+			else
+			{
+				if (m_crpending)
+				{
+					m_crpending = false;
+					++m_line.cr;
+				}
+				m_line.nonascii = true;
+				// Count UTF-8 sequences by their lead octets, which take two
+				// UTF-16 code units from F0 on
+				if (!m_utf8)
+					++m_run;
+				else if ((c & 0xC0) != 0x80)
+					m_run += c < 0xF0 ? 1 : 2;
+			}
+		}
+	}
+}
+
+UINT LineStats::bucket(ULONGLONG octets)
+{
+	unsigned long bit;
+	if (octets > 0xFFFFFFFF)
+		return Buckets - 1;
+	return _BitScanReverse(&bit, static_cast<unsigned long>(octets)) ? bit + 1 : 0;
+}
+
+/**
+ * @brief Adds the current line to the totals, and starts a new one.
+ */
+void LineStats::endLine()
+{
+	for (UINT i = 0; i < TabWidths; ++i)
+	{
+		UINT const width = m_columns[i] + m_run;
+		if (m_totals.widths[i] < width)
+			m_totals.widths[i] = width;
+	}
+	++m_totals.lines;
+	++m_totals.histogram[bucket(m_line.octets)];
+	m_totals.nonascii += m_line.nonascii;
+	m_totals.crlf += m_line.crlf;
+	m_totals.lf += m_line.lf;
+	m_totals.cr += m_line.cr;
+	m_last = m_line;
+	ZeroMemory(&m_line, sizeof m_line);
+	ZeroMemory(m_columns, sizeof m_columns);
+	m_run = 0;
+}
+
+/**
+ * @brief Adds the statistics of a range which has been indexed in parallel,
+ * and takes on its current line.
+ */
+void LineStats::merge(LineStats const &other)
+{
+	for (UINT i = 0; i < TabWidths; ++i)
+	{
+		if (m_totals.widths[i] < other.m_totals.widths[i])
+			m_totals.widths[i] = other.m_totals.widths[i];
+	}
+	m_totals.lines += other.m_totals.lines;
+	for (UINT i = 0; i < Buckets; ++i)
+		m_totals.histogram[i] += other.m_totals.histogram[i];
+	m_totals.nonascii += other.m_totals.nonascii;
+	m_totals.crlf += other.m_totals.crlf;
+	m_totals.lf += other.m_totals.lf;
+	m_totals.cr += other.m_totals.cr;
+	if (other.m_totals.lines != 0)
+		m_last = other.m_last;
+	m_line = other.m_line;
+	CopyMemory(m_columns, other.m_columns, sizeof m_columns);
+	m_run = other.m_run;
+	m_crpending = other.m_crpending;
+	m_odd = other.m_odd;
+}
+
+/**
+ * @brief Determines the totals as of before the last line of the index, which
+ * LoadIndex() leaves to be indexed anew. Widths stay as they are, given that
+ * indexing the line anew yields the same maximum.
+ */
+void LineStats::settle(Totals &totals) const
+{
+	totals = m_totals;
+	// Unless the current line is empty, it is the last line of the index,
+	// and hasn't been accounted for yet
+	if (m_line.octets != 0 || totals.lines == 0)
+		return;
+	--totals.lines;
+	--totals.histogram[bucket(m_last.octets)];
+	totals.nonascii -= m_last.nonascii;
+	totals.crlf -= m_last.crlf;
+	totals.lf -= m_last.lf;
+	totals.cr -= m_last.cr;
+}
+
+/**
+ * @brief Picks up from totals as persisted through settle().
+ */
+void LineStats::resume(Totals const &totals)
+{
+	LineReader::Encoding const encoding =
+		m_wide ? m_bigendian ? LineReader::UCS2BE : LineReader::UCS2LE :
+		m_utf8 ? LineReader::UTF8 : LineReader::ANSI;
+	clear();
+	setEncoding(encoding);
+	m_totals = totals;
+}
+
+/**
+ * @brief Determines the width of the widest line including the current one,
+ * with tabs expanded to the given width, which is a power of two up to 32.
+ */
+UINT LineStats::width(UINT tabwidth) const
+{
+	unsigned long i = 0;
+	_BitScanReverse(&i, tabwidth);
+	if (i >= TabWidths)
+		i = TabWidths - 1;
+	UINT const width = m_columns[i] + m_run;
+	return m_totals.widths[i] > width ? m_totals.widths[i] : width;
+}
+
+/**
+ * @brief Determines a power of two below which the lengths in octets of the
+ * given percentage of lines fall.
+ */
+ULONGLONG LineStats::percentile(UINT percent) const
+{
+	ULONGLONG const wanted = (m_totals.lines * percent + 99) / 100;
+	ULONGLONG count = 0;
+	UINT i = 0;
+	while (i < Buckets - 1 && (count += m_totals.histogram[i]) < wanted)
+		++i;
+	return 1ULL << i;
+}
@@ -0,0 +1,62 @@
+/**
+ * @brief Statistics about the lines of a file, which a LineReader gathers from
+ * the octets it consumes, so that they come at no extra I/O cost. Widths are
+ * in UTF-16 code units as displayed, with tabs expanded to each of the tab
+ * widths from 1 to 32. Line breaks count as CRLF, LF, or lone CR wherever they
+ * occur, regardless of the delimiter.
+ */
+class LineStats
+{
+public:
+	static UINT const TabWidths = 6;
+	static UINT const Buckets = 33;
+	// What persists along with the index, which accounts for complete lines
+	struct Totals
+	{
+		ULONGLONG lines;
+		ULONGLONG nonascii; // lines which contain characters beyond ASCII
+		ULONGLONG crlf;
+		ULONGLONG lf;
+		ULONGLONG cr;
+		ULONGLONG histogram[Buckets]; // lines by bit length of their length in octets
+		UINT widths[TabWidths]; // widest line by log2 of tab width
+	};
+	LineStats() { clear(); }
+	void clear();
+	void setEncoding(LineReader::Encoding);
+	void feed(BYTE const *, size_t);
+	void endLine();
+	void merge(LineStats const &);
+	void settle(Totals &) const;
+	void resume(Totals const &);
+	ULONGLONG lines() const { return m_totals.lines; }
+	ULONGLONG nonascii() const { return m_totals.nonascii; }
+	ULONGLONG crlf() const { return m_totals.crlf; }
+	ULONGLONG lf() const { return m_totals.lf; }
+	ULONGLONG cr() const { return m_totals.cr; }
+	UINT width(UINT tabwidth) const;
+	ULONGLONG percentile(UINT percent) const;
+private:
+	// What a line contributes to the totals
+	struct Line
+	{
+		ULONGLONG octets;
+		ULONGLONG crlf;
+		ULONGLONG lf;
+		ULONGLONG cr;
+		bool nonascii;
+	};
+	void feedUnit(UINT);
+	void tab();
+	static UINT bucket(ULONGLONG octets);
+	Totals m_totals;
+	Line m_line; // line which is being fed
+	Line m_last; // most recent complete line, or all zero if none
+	UINT m_columns[TabWidths]; // columns of m_line up to its last tab
+	UINT m_run; // columns of m_line past its last tab
+	bool m_crpending; // whether the last unit fed was a CR
+	bool m_wide;
+	bool m_bigendian;
+	bool m_utf8;
+	int m_odd; // first octet of a code unit split across calls to feed(), or -1
+};
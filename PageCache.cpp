@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2015 Jochen Neubeck
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INTERNET SOFTWARE CONSORTIUM DISCLAIMS
+ * ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL INTERNET SOFTWARE
+ * CONSORTIUM BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS
+ * ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+ * SOFTWARE.
+ */
+#include <windows.h>
+#include "FileAccess.h"
+#include "PageCache.h"
+
+/**
+ * @brief Sets the number of pages to keep, which drops any pages kept so far.
+ */
+void PageCache::setCapacity(UINT capacity)
+{
+	if (m_memory)
+	{
+		VirtualFree(m_memory, 0, MEM_RELEASE);
+		m_memory = NULL;
+	}
+	if (m_staging)
+	{
+		VirtualFree(m_staging, 0, MEM_RELEASE);
+		m_staging = NULL;
+	}
+	CoTaskMemFree(m_pages);
+	m_pages = NULL;
+	m_capacity = 0;
+	clear();
+	if (capacity == 0)
+		return;
+	m_pages = static_cast<Page *>(CoTaskMemAlloc(capacity * sizeof(Page)));
+	m_memory = static_cast<BYTE *>(VirtualAlloc(NULL, capacity * static_cast<SIZE_T>(PageSize), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+	if (m_pages && m_memory)
+	{
+		m_capacity = capacity;
+	}
+	else
+	{
+		setCapacity(0);
+	}
+}
+
+/**
+ * @brief Drops all pages, as when the file goes away.
+ */
+void PageCache::clear()
+{
+	EnterCriticalSection(&m_cs);
+	m_used = 0;
+	m_newest = None;
+	m_oldest = None;
+	++m_generation;
+	LeaveCriticalSection(&m_cs);
+}
+
+void PageCache::unlink(UINT i)
+{
+	Page &page = m_pages[i];
+	(page.newer != None ? m_pages[page.newer].older : m_newest) = page.older;
+	(page.older != None ? m_pages[page.older].newer : m_oldest) = page.newer;
+}
+
+void PageCache::link(UINT i)
+{
+	Page &page = m_pages[i];
+	page.newer = None;
+	page.older = m_newest;
+	(m_newest != None ? m_pages[m_newest].newer : m_oldest) = i;
+	m_newest = i;
+}
+
+/**
+ * @brief Makes page i the least recently used one, and has it hold nothing,
+ * as when another read has superseded it.
+ */
+void PageCache::retire(UINT i)
+{
+	Page &page = m_pages[i];
+	page.offset = ~0ULL;
+	page.length = 0;
+	page.newer = m_oldest;
+	page.older = None;
+	(m_oldest != None ? m_pages[m_oldest].older : m_newest) = i;
+	m_oldest = i;
+}
+
+UINT PageCache::find(ULONGLONG offset) const
+{
+	UINT i = m_newest;
+	while (i != None && m_pages[i].offset != offset)
+		i = m_pages[i].older;
+	return i;
+}
+
+/**
+ * @brief Takes page i out of the order of use to fill it anew, or, if it is
+ * None, picks an unused or else the least recently used slot for that.
+ * @return Index of the slot, or None if the cache has no capacity.
+ */
+UINT PageCache::claim(UINT i)
+{
+	if (i != None)
+		unlink(i);
+	else if (m_used < m_capacity)
+		i = m_used++;
+	else if ((i = m_oldest) != None)
+		unlink(i);
+	return i;
+}
+
+/**
+ * @brief Finds the page at offset, or reads it into the least recently used
+ * slot, and makes it the most recently used one. Must be called from within
+ * m_cs, which it leaves while reading.
+ * @param [in] needed Number of octets from offset on which the caller needs.
+ * @return Index of the page, or None if it can't be read.
+ */
+UINT PageCache::lookup(HANDLE handle, ULONGLONG offset, DWORD needed)
+{
+	UINT i = find(offset);
+	if (i != None && (m_pages[i].length >= needed || m_pages[i].length == PageSize))
+	{
+		++m_hits;
+		if (i != m_newest)
+		{
+			unlink(i);
+			link(i);
+		}
+		return i;
+	}
+	++m_misses;
+	if ((i = claim(i)) == None)
+		return None;
+	UINT const generation = m_generation;
+	LeaveCriticalSection(&m_cs);
+	DWORD const length = FileAccess::read(handle, offset, m_memory + static_cast<SIZE_T>(i) * PageSize, PageSize);
+	EnterCriticalSection(&m_cs);
+	// Having been cleared meanwhile, the cache has forgotten about the slot
+	if (generation != m_generation)
+		return None;
+	// Another thread may have read the same page meanwhile
+	UINT const j = find(offset);
+	if (j != None)
+	{
+		unlink(j);
+		retire(j);
+	}
+	Page &page = m_pages[i];
+	page.offset = offset;
+	page.length = length;
+	link(i);
+	return i;
+}
+
+/**
+ * @brief Reads count octets from offset on, like ReadFile() would, or reads
+ * them directly if the cache has no capacity.
+ * @return Number of octets read, which is less than count at end of file.
+ */
+DWORD PageCache::read(HANDLE handle, ULONGLONG offset, void *buffer, DWORD count)
+{
+	if (m_capacity == 0)
+		return FileAccess::read(handle, offset, buffer, count);
+	EnterCriticalSection(&m_cs);
+	BYTE *p = static_cast<BYTE *>(buffer);
+	DWORD total = 0;
+	while (total < count)
+	{
+		DWORD const skip = static_cast<DWORD>(offset % PageSize);
+		DWORD n = PageSize - skip;
+		if (n > count - total)
+			n = count - total;
+		UINT const i = lookup(handle, offset - skip, skip + n);
+		if (i == None)
+			break;
+		DWORD const length = m_pages[i].length;
+		if (length <= skip)
+			break;
+		if (n > length - skip)
+			n = length - skip;
+		memcpy(p, m_memory + static_cast<SIZE_T>(i) * PageSize + skip, n);
+		p += n;
+		offset += n;
+		total += n;
+		if (length < PageSize)
+			break;
+	}
+	LeaveCriticalSection(&m_cs);
+	return total;
+}
+
+/**
+ * @brief Makes sure that the pages which overlap with count octets from offset
+ * on are there, and reads whichever aren't in a single go, so that the reads
+ * which follow don't each have to wait for I/O of their own. Spans of more
+ * than half the capacity are left alone, as they would evict themselves.
+ */
+void PageCache::preload(HANDLE handle, ULONGLONG offset, DWORD count)
+{
+	if (count == 0)
+		return;
+	EnterCriticalSection(&m_cs);
+	ULONGLONG lower = offset - offset % PageSize;
+	ULONGLONG upper = offset + count + PageSize - 1;
+	upper -= upper % PageSize;
+	// Keep the pages which are there from being evicted by those to come
+	for (ULONGLONG page = lower; page < upper && page - lower < static_cast<ULONGLONG>(m_capacity) * PageSize; page += PageSize)
+	{
+		UINT const i = find(page);
+		if (i != None && i != m_newest)
+		{
+			unlink(i);
+			link(i);
+		}
+	}
+	while (lower < upper && isFull(find(lower)))
+		lower += PageSize;
+	while (upper > lower && isFull(find(upper - PageSize)))
+		upper -= PageSize;
+	UINT const pages = static_cast<UINT>((upper - lower) / PageSize);
+	// Return early if the pages are there, as they are for most repaints, or
+	// if there is just one, which would be read in a single go anyway
+	if (pages < 2 || pages > m_capacity / 2)
+	{
+		LeaveCriticalSection(&m_cs);
+		return;
+	}
+	UINT const generation = m_generation;
+	// Take the buffer to read into, so that a concurrent preload allocates
+	// one of its own rather than shares it
+	BYTE *buffer = m_staging;
+	m_staging = NULL;
+	LeaveCriticalSection(&m_cs);
+	if (buffer == NULL)
+	{
+		buffer = static_cast<BYTE *>(VirtualAlloc(NULL, m_capacity / 2 * static_cast<SIZE_T>(PageSize), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+		if (buffer == NULL)
+			return;
+	}
+	DWORD const length = FileAccess::read(handle, lower, buffer, pages * PageSize);
+	EnterCriticalSection(&m_cs);
+	// Having been cleared meanwhile, the cache is about another file
+	for (DWORD done = 0; done < length && generation == m_generation; done += PageSize)
+	{
+		UINT const i = claim(find(lower + done));
+		if (i == None)
+			break;
+		DWORD const n = length - done < PageSize ? length - done : PageSize;
+		memcpy(m_memory + static_cast<SIZE_T>(i) * PageSize, buffer + done, n);
+		m_pages[i].offset = lower + done;
+		m_pages[i].length = n;
+		link(i);
+		++m_misses;
+	}
+	// Keep the buffer for the next preload, unless one is kept already
+	if (m_staging == NULL)
+	{
+		m_staging = buffer;
+		buffer = NULL;
+	}
+	LeaveCriticalSection(&m_cs);
+	if (buffer)
+		VirtualFree(buffer, 0, MEM_RELEASE);
+}
+
+/**
+ * @brief Tells whether the page at offset is there in full, so that reading
+ * it ahead would be wasted effort.
+ */
+bool PageCache::contains(ULONGLONG offset)
+{
+	EnterCriticalSection(&m_cs);
+	bool const full = isFull(find(offset));
+	LeaveCriticalSection(&m_cs);
+	return full;
+}
+
+/**
+ * @brief Puts a page which has been read elsewhere into the cache, as the
+ * most recently used one, without counting it as a hit or a miss.
+ */
+void PageCache::insert(ULONGLONG offset, void const *data, DWORD length)
+{
+	EnterCriticalSection(&m_cs);
+	UINT const i = claim(find(offset));
+	if (i != None)
+	{
+		memcpy(m_memory + static_cast<SIZE_T>(i) * PageSize, data, length);
+		m_pages[i].offset = offset;
+		m_pages[i].length = length;
+		link(i);
+	}
+	LeaveCriticalSection(&m_cs);
+}
@@ -0,0 +1,64 @@
+/**
+ * @brief A cache of aligned pages of the current file, which those reads go
+ * through that the UI thread does for display and copying, so that painting
+ * the same lines again doesn't take any I/O. Pages get evicted in order of
+ * least recent use. A page which ends short of PageSize, as at end of file,
+ * gets read anew whenever a read goes past its end, so as to catch up with
+ * the file growing. A Prefetcher may insert pages from another thread, so
+ * the cache serializes access through a critical section, which it leaves
+ * while waiting for I/O. A page being read meanwhile is out of the order of
+ * use, so that no other thread gets to see or to claim it.
+ */
+class PageCache
+{
+public:
+	static DWORD const PageSize = 0x10000;
+	PageCache()
+		: m_pages(NULL), m_memory(NULL), m_staging(NULL), m_capacity(0), m_used(0), m_newest(None), m_oldest(None), m_generation(0), m_hits(0), m_misses(0)
+	{
+		InitializeCriticalSection(&m_cs);
+	}
+	~PageCache()
+	{
+		setCapacity(0);
+		DeleteCriticalSection(&m_cs);
+	}
+	void setCapacity(UINT);
+	UINT capacity() const { return m_capacity; }
+	void clear();
+	DWORD read(HANDLE, ULONGLONG offset, void *buffer, DWORD count);
+	void preload(HANDLE, ULONGLONG offset, DWORD count);
+	bool contains(ULONGLONG offset);
+	void insert(ULONGLONG offset, void const *data, DWORD length);
+	ULONGLONG hits() const { return m_hits; }
+	ULONGLONG misses() const { return m_misses; }
+private:
+	static UINT const None = ~0U;
+	struct Page
+	{
+		ULONGLONG offset;
+		DWORD length; // number of valid octets
+		UINT newer;
+		UINT older;
+	};
+	UINT lookup(HANDLE, ULONGLONG offset, DWORD needed);
+	UINT find(ULONGLONG offset) const;
+	UINT claim(UINT);
+	bool isFull(UINT i) const { return i != None && m_pages[i].length == PageSize; }
+	void unlink(UINT);
+	void link(UINT);
+	void retire(UINT);
+	Page *m_pages;
+	BYTE *m_memory; // m_capacity pages of PageSize each
+	BYTE *m_staging; // m_capacity / 2 pages for preload() to read into, once needed
+	UINT m_capacity;
+	UINT m_used;
+	UINT m_newest;
+	UINT m_oldest;
+	UINT m_generation; // number of times cleared, so as to discard reads which were in flight
+	ULONGLONG m_hits;
+	ULONGLONG m_misses;
+	CRITICAL_SECTION m_cs;
+	PageCache(const PageCache &);
+	PageCache &operator=(const PageCache &);
+};
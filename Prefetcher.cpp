@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2015 Jochen Neubeck
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INTERNET SOFTWARE CONSORTIUM DISCLAIMS
+ * ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL INTERNET SOFTWARE
+ * CONSORTIUM BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS
+ * ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+ * SOFTWARE.
+ */
+#include <windows.h>
+#include "FileAccess.h"
+#include "PageCache.h"
+#include "Prefetcher.h"
+
+// ReOpenFile() is available as of Windows Vista, so look it up dynamically
+static HANDLE (WINAPI *const ReOpenFileProc)(HANDLE, DWORD, DWORD, DWORD) =
+	reinterpret_cast<HANDLE (WINAPI *)(HANDLE, DWORD, DWORD, DWORD)>(
+		GetProcAddress(GetModuleHandle(TEXT("KERNEL32")), "ReOpenFile"));
+
+/**
+ * @brief Starts the thread which serves requests for the file behind handle.
+ * @return Whether prefetching is possible, which it isn't without a cache of
+ * some capacity, or on systems which lack ReOpenFile().
+ */
+bool Prefetcher::start(HANDLE handle, PageCache *cache)
+{
+	stop();
+	if (ReOpenFileProc == NULL || cache->capacity() == 0)
+		return false;
+	m_handle = ReOpenFileProc(handle, FILE_GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0);
+	if (m_handle == INVALID_HANDLE_VALUE)
+		return false;
+	m_cache = cache;
+	m_begin = m_end = 0;
+	m_stop = false;
+	m_wakeup = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (m_wakeup)
+		m_thread = CreateThread(NULL, 0, StartThread, this, 0, NULL);
+	if (m_thread == NULL)
+		stop();
+	return m_thread != NULL;
+}
+
+/**
+ * @brief Asks for the pages which overlap with [begin, end) to be read.
+ */
+void Prefetcher::request(ULONGLONG begin, ULONGLONG end, bool backward)
+{
+	if (m_thread == NULL)
+		return;
+	EnterCriticalSection(&m_cs);
+	m_begin = begin;
+	m_end = end;
+	m_backward = backward;
+	InterlockedIncrement(&m_generation);
+	LeaveCriticalSection(&m_cs);
+	SetEvent(m_wakeup);
+}
+
+void Prefetcher::stop()
+{
+	if (m_thread)
+	{
+		m_stop = true;
+		SetEvent(m_wakeup);
+		WaitForSingleObject(m_thread, INFINITE);
+		CloseHandle(m_thread);
+		m_thread = NULL;
+	}
+	if (m_wakeup)
+	{
+		CloseHandle(m_wakeup);
+		m_wakeup = NULL;
+	}
+	if (m_handle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_handle);
+		m_handle = INVALID_HANDLE_VALUE;
+	}
+	m_cache = NULL;
+}
+
+DWORD WINAPI Prefetcher::StartThread(LPVOID pv)
+{
+	return static_cast<Prefetcher *>(pv)->Thread();
+}
+
+DWORD Prefetcher::Thread()
+{
+	BYTE *const buffer = static_cast<BYTE *>(VirtualAlloc(NULL, PageCache::PageSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+	if (buffer == NULL)
+		return 0;
+	while (WaitForSingleObject(m_wakeup, INFINITE) == WAIT_OBJECT_0 && !m_stop)
+	{
+		EnterCriticalSection(&m_cs);
+		LONG const generation = m_generation;
+		ULONGLONG const begin = m_begin - m_begin % PageCache::PageSize;
+		ULONGLONG const end = m_end;
+		bool const backward = m_backward;
+		LeaveCriticalSection(&m_cs);
+		if (begin >= end)
+			continue;
+		ULONGLONG const last = (end - 1) - (end - 1) % PageCache::PageSize;
+		ULONGLONG offset = backward ? last : begin;
+		// Give up on the request as soon as another one comes in
+		while (!m_stop && m_generation == generation)
+		{
+			if (!m_cache->contains(offset))
+			{
+				DWORD const length = FileAccess::read(m_handle, offset, buffer, PageCache::PageSize);
+				if (length == 0)
+					break;
+				if (m_generation != generation)
+					break;
+				m_cache->insert(offset, buffer, length);
+			}
+			if (backward ? offset == begin : offset == last)
+				break;
+			if (backward)
+				offset -= PageCache::PageSize;
+			else
+				offset += PageCache::PageSize;
+		}
+	}
+	VirtualFree(buffer, 0, MEM_RELEASE);
+	return 0;
+}
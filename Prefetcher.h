@@ -0,0 +1,40 @@
+/**
+ * @brief Reads pages of the current file into a PageCache on a thread of its
+ * own, so that scrolling finds the lines it brings into view already there.
+ * Each request supersedes the previous one, which is abandoned at the next
+ * page boundary, as when the direction of scrolling reverses.
+ */
+class Prefetcher
+{
+public:
+	Prefetcher()
+		: m_thread(NULL), m_handle(INVALID_HANDLE_VALUE), m_wakeup(NULL), m_cache(NULL)
+		, m_begin(0), m_end(0), m_backward(false), m_generation(0), m_stop(false)
+	{
+		InitializeCriticalSection(&m_cs);
+	}
+	~Prefetcher()
+	{
+		stop();
+		DeleteCriticalSection(&m_cs);
+	}
+	bool start(HANDLE, PageCache *);
+	bool running() const { return m_thread != NULL; }
+	void request(ULONGLONG begin, ULONGLONG end, bool backward);
+	void stop();
+private:
+	static DWORD WINAPI StartThread(LPVOID);
+	DWORD Thread();
+	HANDLE m_thread;
+	HANDLE m_handle; // own handle to the file, so as to leave the file pointer alone
+	HANDLE m_wakeup; // signaled when a request is due
+	PageCache *m_cache;
+	CRITICAL_SECTION m_cs; // guards the request
+	ULONGLONG m_begin;
+	ULONGLONG m_end;
+	bool m_backward; // whether to proceed from m_end down to m_begin
+	LONG volatile m_generation; // counts requests so as to notice new ones
+	bool volatile m_stop;
+	Prefetcher(const Prefetcher &);
+	Prefetcher &operator=(const Prefetcher &);
+};
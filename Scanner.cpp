@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2015 Jochen Neubeck
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INTERNET SOFTWARE CONSORTIUM DISCLAIMS
+ * ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL INTERNET SOFTWARE
+ * CONSORTIUM BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ * DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR
+ * PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS
+ * ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+ * SOFTWARE.
+ */
+#ifdef _WIN32
+#include <windows.h>
+#include <intrin.h>
+#else
+// Just enough of Win32 to build and check the kernels on other platforms
+#include <stddef.h>
+#include <string.h>
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int DWORD;
+typedef unsigned int UINT;
+typedef unsigned short WCHAR;
+static unsigned char _BitScanForward(unsigned long *index, unsigned long mask)
+{
+	if (mask == 0)
+		return 0;
+	*index = static_cast<unsigned long>(__builtin_ctzl(mask));
+	return 1;
+}
+#endif
+#include <emmintrin.h>
+#include "Scanner.h"
+
+static size_t ScanOctetsGeneric(BYTE const *p, size_t n, BYTE eol, WORD *offsets)
+{
+	size_t count = 0;
+	BYTE const *const lower = p;
+	BYTE const *const upper = p + n;
+	while (BYTE const *q = static_cast<BYTE const *>(memchr(p, eol, upper - p)))
+	{
+		p = q + 1;
+		offsets[count++] = static_cast<WORD>(p - lower);
+	}
+	return count;
+}
+
+// Number of blocks of 32 octets in a row without a delimiter after which to
+// leave it to memchr() to find the next one, which is quicker on long lines
+static size_t const SparseBlocks = 4;
+
+static size_t ScanOctetsSSE2(BYTE const *p, size_t n, BYTE eol, WORD *offsets)
+{
+	size_t count = 0;
+	size_t i = 0;
+	size_t empty = 0;
+	__m128i const needle = _mm_set1_epi8(static_cast<char>(eol));
+	// Compare 32 octets per iteration and harvest the matches from the masks
+	while (i + 32 <= n)
+	{
+		if (empty == SparseBlocks)
+		{
+			BYTE const *const q = static_cast<BYTE const *>(memchr(p + i, eol, n - i));
+			if (q == NULL)
+				return count;
+			i = q - p + 1;
+			offsets[count++] = static_cast<WORD>(i);
+			empty = 0;
+			continue;
+		}
+		__m128i const lo = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+		__m128i const hi = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i + 16));
+		unsigned long mask =
+			static_cast<unsigned long>(_mm_movemask_epi8(_mm_cmpeq_epi8(lo, needle))) |
+			static_cast<unsigned long>(_mm_movemask_epi8(_mm_cmpeq_epi8(hi, needle))) << 16;
+		i += 32;
+		empty = mask ? 0 : empty + 1;
+		unsigned long bit;
+		while (_BitScanForward(&bit, mask))
+		{
+			offsets[count++] = static_cast<WORD>(i - 31 + bit);
+			mask &= mask - 1;
+		}
+	}
+	if (i < n)
+	{
+		WORD *const tail = offsets + count;
+		size_t const found = ScanOctetsGeneric(p + i, n - i, eol, tail);
+		for (size_t j = 0; j < found; ++j)
+			tail[j] = static_cast<WORD>(tail[j] + i);
+		count += found;
+	}
+	return count;
+}
+
+static ScanProc ChooseScanOctets()
+{
+#ifdef _M_IX86
+	if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		return ScanOctetsGeneric;
+#endif
+	return ScanOctetsSSE2;
+}
+
+ScanProc const ScanOctets = ChooseScanOctets();
+
+static size_t ScanWordsGeneric(BYTE const *p, size_t n, WORD eol, WORD *offsets)
+{
+	size_t count = 0;
+	WORD const *const lower = reinterpret_cast<WORD const *>(p);
+	WORD const *const upper = lower + n / 2;
+	for (WORD const *q = lower; q < upper; ++q)
+	{
+		if (*q == eol)
+			offsets[count++] = static_cast<WORD>(reinterpret_cast<BYTE const *>(q + 1) - p);
+	}
+	return count;
+}
+
+static size_t ScanWordsSSE2(BYTE const *p, size_t n, WORD eol, WORD *offsets)
+{
+	size_t count = 0;
+	size_t i = 0;
+	__m128i const needle = _mm_set1_epi16(static_cast<short>(eol));
+	// Compare 16 code units per iteration, of which each yields two mask bits
+	while (i + 32 <= n)
+	{
+		__m128i const lo = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+		__m128i const hi = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i + 16));
+		unsigned long mask = (
+			static_cast<unsigned long>(_mm_movemask_epi8(_mm_cmpeq_epi16(lo, needle))) |
+			static_cast<unsigned long>(_mm_movemask_epi8(_mm_cmpeq_epi16(hi, needle))) << 16) & 0x55555555;
+		i += 32;
+		unsigned long bit;
+		while (_BitScanForward(&bit, mask))
+		{
+			offsets[count++] = static_cast<WORD>(i - 30 + bit);
+			mask &= mask - 1;
+		}
+	}
+	if (i < n)
+	{
+		WORD *const tail = offsets + count;
+		size_t const found = ScanWordsGeneric(p + i, n - i, eol, tail);
+		for (size_t j = 0; j < found; ++j)
+			tail[j] = static_cast<WORD>(tail[j] + i);
+		count += found;
+	}
+	return count;
+}
+
+static ScanWideProc ChooseScanWords()
+{
+#ifdef _M_IX86
+	if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		return ScanWordsGeneric;
+#endif
+	return ScanWordsSSE2;
+}
+
+ScanWideProc const ScanWords = ChooseScanWords();
+
+static size_t WidenPrintableGeneric(BYTE const *p, size_t n, WCHAR *q)
+{
+	size_t i = 0;
+	while (i < n && p[i] >= 0x20 && p[i] < 0x7F)
+	{
+		q[i] = p[i];
+		++i;
+	}
+	return i;
+}
+
+static size_t WidenPrintableSSE2(BYTE const *p, size_t n, WCHAR *q)
+{
+	size_t i = 0;
+	__m128i const space = _mm_set1_epi8(0x20);
+	__m128i const del = _mm_set1_epi8(0x7F);
+	__m128i const zero = _mm_setzero_si128();
+	// Octets of 0x80 and above compare as negative, and thus fall below space
+	while (i + 16 <= n)
+	{
+		__m128i const x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+		if (_mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(x, space), _mm_cmpeq_epi8(x, del))))
+			break;
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(q + i), _mm_unpacklo_epi8(x, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(q + i + 8), _mm_unpackhi_epi8(x, zero));
+		i += 16;
+	}
+	return i + WidenPrintableGeneric(p + i, n - i, q + i);
+}
+
+static WidenProc ChooseWidenPrintable()
+{
+#ifdef _M_IX86
+	if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		return WidenPrintableGeneric;
+#endif
+	return WidenPrintableSSE2;
+}
+
+WidenProc const WidenPrintable = ChooseWidenPrintable();
+
+static size_t SkipPlainGeneric(BYTE const *p, size_t n)
+{
+	size_t i = 0;
+	while (i < n && p[i] < 0x80 && p[i] != '\t' && p[i] != '\n' && p[i] != '\r')
+		++i;
+	return i;
+}
+
+static size_t SkipPlainSSE2(BYTE const *p, size_t n)
+{
+	size_t i = 0;
+	__m128i const zero = _mm_setzero_si128();
+	__m128i const tab = _mm_set1_epi8('\t');
+	__m128i const lf = _mm_set1_epi8('\n');
+	__m128i const cr = _mm_set1_epi8('\r');
+	// Octets of 0x80 and above compare as negative
+	while (i + 16 <= n)
+	{
+		__m128i const x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+		__m128i const special = _mm_or_si128(
+			_mm_or_si128(_mm_cmplt_epi8(x, zero), _mm_cmpeq_epi8(x, tab)),
+			_mm_or_si128(_mm_cmpeq_epi8(x, lf), _mm_cmpeq_epi8(x, cr)));
+		unsigned long bit;
+		if (_BitScanForward(&bit, _mm_movemask_epi8(special)))
+			return i + bit;
+		i += 16;
+	}
+	return i + SkipPlainGeneric(p + i, n - i);
+}
+
+static SkipProc ChooseSkipPlain()
+{
+#ifdef _M_IX86
+	if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		return SkipPlainGeneric;
+#endif
+	return SkipPlainSSE2;
+}
+
+SkipProc const SkipPlain = ChooseSkipPlain();
+
+size_t ExpandIdentity(BYTE const *p, size_t n, DWORD const *identity, UINT tabwidth, WCHAR *q, size_t capacity, size_t *written)
+{
+	size_t const tabmask = tabwidth - 1;
+	size_t i = 0;
+	size_t w = *written;
+	for (;;)
+	{
+		size_t const k = WidenPrintable(p + i, n - i, q + w);
+		i += k;
+		w += k;
+		if (i == n)
+			break;
+		BYTE const c = p[i];
+		if (c == '\t')
+		{
+			size_t const spaces = (w | tabmask) + 1 - w;
+			// Keep room for the octets yet to come
+			if (w + spaces + (n - i - 1) > capacity)
+				break;
+			for (size_t j = 0; j < spaces; ++j)
+				q[w++] = ' ';
+		}
+		else if (c < 0x80 && (identity[c >> 5] & (1UL << (c & 31))))
+		{
+			q[w++] = c;
+		}
+		else
+		{
+			break;
+		}
+		++i;
+	}
+	*written = w;
+	return i;
+}
@@ -0,0 +1,61 @@
+/**
+ * @brief Finds all occurrences of a delimiter within a block of memory.
+ * @param [in] p Start of block.
+ * @param [in] n Size of block in bytes, which must not exceed ScanStride.
+ * @param [in] eol Delimiter to search for.
+ * @param [out] offsets Receives the offsets just past each delimiter found.
+ * @return Number of delimiters found.
+ */
+typedef size_t (*ScanProc)(BYTE const *p, size_t n, BYTE eol, WORD *offsets);
+
+extern ScanProc const ScanOctets;
+
+/**
+ * @brief Like ScanProc, but for a delimiter which is a 16-bit code unit, in
+ * the byte order of the block. A trailing odd octet never matches.
+ */
+typedef size_t (*ScanWideProc)(BYTE const *p, size_t n, WORD eol, WORD *offsets);
+
+extern ScanWideProc const ScanWords;
+
+/**
+ * @brief Widens octets to UTF-16 for as long as they are printable ASCII,
+ * i.e. from 0x20 through 0x7E.
+ * @param [in] p Start of octets.
+ * @param [in] n Number of octets.
+ * @param [out] q Receives the code units.
+ * @return Number of octets widened, which is less than n if one is not.
+ */
+typedef size_t (*WidenProc)(BYTE const *p, size_t n, WCHAR *q);
+
+extern WidenProc const WidenPrintable;
+
+/**
+ * @brief Skips octets for as long as they are ASCII other than TAB, LF, or CR,
+ * each of which takes a single column with no further ado.
+ * @param [in] p Start of octets.
+ * @param [in] n Number of octets.
+ * @return Number of octets skipped, which is less than n if one is not.
+ */
+typedef size_t (*SkipProc)(BYTE const *p, size_t n);
+
+extern SkipProc const SkipPlain;
+
+/**
+ * @brief Widens octets which map to themselves, and expands tabs along the way.
+ * Printable ASCII is taken to map to itself regardless of identity.
+ * @param [in] p Start of octets.
+ * @param [in] n Number of octets.
+ * @param [in] identity Bitmap of the octets below 0x80 which map to themselves.
+ * @param [in] tabwidth Distance between tab stops, which is a power of two.
+ * @param [out] q Receives the code units from *written on, which is also the
+ * column at which the octets start.
+ * @param [in] capacity Number of code units q has room for, which must be
+ * enough for the octets if they have no tabs.
+ * @param [in,out] written Number of code units in q.
+ * @return Number of octets expanded, which is less than n if one does not map
+ * to itself, or if a tab leaves too little room for the octets after it.
+ */
+size_t ExpandIdentity(BYTE const *p, size_t n, DWORD const *identity, UINT tabwidth, WCHAR *q, size_t capacity, size_t *written);
+
+size_t const ScanStride = 0x8000;
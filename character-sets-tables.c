@@ -0,0 +1,59 @@
+/* Dumps what the octets of the single-byte code pages which character-sets.dll
+ * refers to decode to, as MultiByteToWideChar() has them, so that decoders can
+ * be checked against the system on platforms which lack it.
+ * Usage: character-sets-tables character-sets.dll > character-sets-tables.h
+ * The output expands a variadic $(CP, ...) to be defined by the includer.
+ */
+
+#include <windows.h>
+#include <stdio.h>
+
+int main(int argc, char *argv[])
+{
+	static BYTE seen[0x10000];
+	HMODULE module;
+	BYTE const *base;
+	IMAGE_DOS_HEADER const *mz;
+	IMAGE_NT_HEADERS const *pe;
+	IMAGE_EXPORT_DIRECTORY const *eat;
+	DWORD const *functions;
+	DWORD i;
+	UINT cp;
+	if (argc != 2)
+		return 1;
+	/* Have the loader lay out the image so that RVAs apply as they are */
+	module = LoadLibraryExA(argv[1], NULL, DONT_RESOLVE_DLL_REFERENCES);
+	if (module == NULL)
+		return 1;
+	base = (BYTE const *)module;
+	mz = (IMAGE_DOS_HEADER const *)base;
+	pe = (IMAGE_NT_HEADERS const *)(base + mz->e_lfanew);
+	eat = (IMAGE_EXPORT_DIRECTORY const *)(base + pe->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress);
+	functions = (DWORD const *)(base + eat->AddressOfFunctions);
+	/* Each export is an EncodingInfo, whose code page follows its id */
+	for (i = 0; i < eat->NumberOfFunctions; ++i)
+		if (functions[i] != 0)
+			seen[((WORD const *)(base + functions[i]))[1]] = 1;
+	printf("/* Generated by character-sets-tables.c */\n");
+	for (cp = 1; cp < 0x10000; ++cp)
+	{
+		CPINFO info;
+		char octets[0x100];
+		WCHAR units[0x100];
+		UINT j;
+		if (!seen[cp] || cp == CP_UTF7 || cp == CP_UTF8 || cp == 1200 || cp == 1201)
+			continue;
+		if (!GetCPInfo(cp, &info) || info.MaxCharSize != 1)
+			continue;
+		for (j = 0; j < 0x100; ++j)
+			octets[j] = (char)j;
+		if (MultiByteToWideChar(cp, MB_USEGLYPHCHARS, octets, 0x100, units, 0x100) != 0x100)
+			continue;
+		printf("\n$(%u", cp);
+		for (j = 0; j < 0x100; ++j)
+			printf(j % 8 ? ", 0x%04X" : ",\n\t0x%04X", units[j]);
+		printf("\n)\n");
+	}
+	FreeLibrary(module);
+	return 0;
+}
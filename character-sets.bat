@@ -6,3 +6,5 @@ msxsl character-sets.xml character-sets.rc.xsl > character-sets.rc
 msxsl character-sets.xml character-sets.def.xsl > character-sets.def
 rc character-sets.rc
 cl character-sets.c character-sets-ie5.c /link /dll /noentry /map character-sets.res /def:character-sets.def /machine:x86 /out:character-sets.dll
+cl character-sets-tables.c
+character-sets-tables character-sets.dll > character-sets-tables.h
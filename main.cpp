@@ -20,10 +20,23 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <new>
 
 #include "util.h"
 #include "subclass.h"
+#include "FileAccess.h"
 #include "LineReader.h"
+#include "Scanner.h"
+#include "Decoder.h"
+#include "Arena.h"
+#include "LineCodes.h"
+#include "LineIndex.h"
+#include "LineStats.h"
+#include "PageCache.h"
+#include "LineCache.h"
+#include "ColumnIndex.h"
+#include "FileView.h"
+#include "Prefetcher.h"
 #include "Transcoder.h"
 #include "VersionData.h"
 #include "EncodingInfo.h"
@@ -104,19 +117,188 @@ static UINT CodePageFromMenuText(BSTR q)
 	return codepage;
 }
 
-struct LineData
+// Layout of the file through which the index of a file persists across
+// sessions, with blocks as written by LineIndex::write() following
+struct IndexHeader
 {
-	DWORD LowPart;
-	UINT DECLARE_BIT_FIELD(HighPart, 6);
-	UINT DECLARE_BIT_FIELD(flags, 2);
-	UINT DECLARE_BIT_FIELD(len, 24);
+	DWORD magic;
+	WORD mode; // encoding and delimiter as passed to MainWindow::Open()
+	ULONGLONG terminator; // as returned from HashBytes() for the record terminator
+	ULONGLONG lines;
+	ULONGLONG size; // offset just past the last line
+	ULONGLONG sample; // as returned from SampleContents()
+	FILETIME mtime;
+	TCHAR path[MAX_PATH];
+	LineStats::Totals stats; // as of before the last line
 };
 
-// Do a few compile-time sanity checks
-C_ASSERT(sizeof(LineData) == 8);
-C_ASSERT(MIN_BIT_FIELD_SIGNED(LineData, len) == 0x800000);
-C_ASSERT(MAX_BIT_FIELD_SIGNED(LineData, len) == 0x7FFFFF);
-C_ASSERT(MAX_BIT_FIELD_UNSIGNED(LineData, len) == 0xFFFFFF);
+static DWORD const IndexMagic = 0x35584449; // "IDX5"
+
+static ULONGLONG HashBytes(ULONGLONG hash, void const *p, size_t n)
+{
+	// FNV-1a
+	BYTE const *q = static_cast<BYTE const *>(p);
+	while (n--)
+		hash = (hash ^ *q++) * 0x100000001B3ULL;
+	return hash;
+}
+
+/**
+ * @brief Hashes samples taken at regular intervals across the given extent of
+ * a file, so as to notice changes to other than its tail at little cost.
+ */
+static ULONGLONG SampleContents(HANDLE handle, ULONGLONG size)
+{
+	ULONGLONG hash = 0xCBF29CE484222325ULL;
+	BYTE buffer[0x1000];
+	for (UINT i = 0; i <= 16; ++i)
+	{
+		// The last sample covers the tail of the extent
+		ULONGLONG offset = size / 16 * i;
+		if (i == 16)
+			offset = size > sizeof buffer ? size - sizeof buffer : 0;
+		DWORD count = size - offset < sizeof buffer ? static_cast<DWORD>(size - offset) : sizeof buffer;
+		DWORD bytes = FileAccess::read(handle, offset, buffer, count);
+		hash = HashBytes(hash, &bytes, sizeof bytes);
+		hash = HashBytes(hash, buffer, bytes);
+	}
+	return hash;
+}
+
+/**
+ * @brief Determines which octets below 0x80 a code page maps to the same
+ * code units, so that lines made of nothing else need no transcoding.
+ */
+static void MapIdentity(UINT codepage, DWORD *identity)
+{
+	ZeroMemory(identity, 4 * sizeof *identity);
+	switch (codepage)
+	{
+	case CP_UTF7: // shifts state on '+'
+	case 1200: // UCS2LE
+	case 1201: // UCS2BE
+		return;
+	}
+	char octets[0x80];
+	WCHAR wide[0x80];
+	for (UINT i = 0; i < 0x80; ++i)
+		octets[i] = static_cast<char>(i);
+	DWORD const flags = codepage != CP_UTF8 ? MB_USEGLYPHCHARS : 0;
+	if (MultiByteToWideChar(codepage, flags, octets, 0x80, wide, 0x80) == 0x80)
+	{
+		for (UINT i = 0; i < 0x80; ++i)
+			if (wide[i] == i)
+				identity[i >> 5] |= 1UL << (i & 31);
+	}
+}
+
+/**
+ * @brief Determines the most octets a character takes in a code page, or 0 if
+ * the code page is stateful or unknown.
+ */
+static UINT MaxCharSize(UINT codepage)
+{
+	switch (codepage)
+	{
+	case CP_UTF7:
+		return 0;
+	case CP_UTF8:
+		return 4;
+	case 1200: // UCS2LE
+	case 1201: // UCS2BE
+		return 2;
+	}
+	CPINFO info;
+	return GetCPInfo(codepage, &info) ? info.MaxCharSize : 0;
+}
+
+/**
+ * @brief Tells how many columns it takes at most to fill the given number of
+ * pixels, which is as many as fit if the font has a fixed pitch, or else one
+ * per pixel.
+ */
+static UINT ColumnsToFill(HDC hdc, int pixels)
+{
+	if (pixels <= 0)
+		return 0;
+	TEXTMETRIC tm;
+	// TMPF_FIXED_PITCH actually means that the font has a variable pitch
+	if (GetTextMetrics(hdc, &tm) && !(tm.tmPitchAndFamily & TMPF_FIXED_PITCH) && tm.tmAveCharWidth > 0)
+		return pixels / tm.tmAveCharWidth + 1;
+	return pixels;
+}
+
+/**
+ * @brief Has the system decode all 256 octets of a single-byte code page, so
+ * that lines can be decoded through a table of what they map to.
+ * @return Whether the code page is a single-byte one.
+ */
+static bool LoadDecodeTable(UINT codepage, DecodeTable &table)
+{
+	switch (codepage)
+	{
+	case CP_UTF7:
+	case CP_UTF8:
+	case 1200: // UCS2LE
+	case 1201: // UCS2BE
+		return false;
+	}
+	CPINFO info;
+	if (!GetCPInfo(codepage, &info) || info.MaxCharSize != 1)
+		return false;
+	char octets[0x100];
+	for (UINT i = 0; i < 0x100; ++i)
+		octets[i] = static_cast<char>(i);
+	WCHAR *const units = reinterpret_cast<WCHAR *>(table.units);
+	if (MultiByteToWideChar(codepage, MB_USEGLYPHCHARS, octets, 0x100, units, 0x100) != 0x100)
+		return false;
+	table.init();
+	return true;
+}
+
+/**
+ * @brief Parses a record terminator as given on the command line, which may
+ * contain \r, \n, \t, \\, and \xHH escapes.
+ * @return Length of the terminator, or 0 if empty or longer than max.
+ */
+static UINT ParseTerminator(char *terminator, UINT max, LPCTSTR text)
+{
+	UINT length = 0;
+	while (TCHAR c = *text++)
+	{
+		if (c == _T('\\'))
+		{
+			switch (c = *text++)
+			{
+			case _T('r'):
+				c = _T('\r');
+				break;
+			case _T('n'):
+				c = _T('\n');
+				break;
+			case _T('t'):
+				c = _T('\t');
+				break;
+			case _T('x'):
+				{
+					TCHAR hex[3] = { text[0], text[0] ? text[1] : _T('\0'), _T('\0') };
+					LPTSTR end = hex;
+					c = static_cast<TCHAR>(_tcstoul(hex, &end, 16));
+					if (end == hex)
+						return 0;
+					text += end - hex;
+				}
+				break;
+			case _T('\0'):
+				return 0;
+			}
+		}
+		if (length == max)
+			return 0;
+		terminator[length++] = static_cast<char>(c);
+	}
+	return length;
+}
 
 class TextBoxDialog : public Subclass
 {
@@ -232,7 +414,10 @@ public:
 				HDROP hDrop = reinterpret_cast<HDROP>(storage.hGlobal);
 				TCHAR path[MAX_PATH];
 				if (DragQueryFile(hDrop, 0, path, _countof(path)))
+				{
+					m_terminatorlength = 0;
 					Open(path, HIWORD(item.lParam));
+				}
 				GlobalFree(storage.hGlobal);
 			}
 		}
@@ -257,8 +442,10 @@ private:
 	void AboutBox();
 	void UpdateWindowTitle();
 	void AdjustScrollRange();
+	void AdjustWidth();
+	void Anticipate();
 	void DoHScroll(WORD);
-	void IndicateProgress(DWORD lines, DWORD ticks);
+	void IndicateProgress(ULONGLONG lines, DWORD ticks);
 	void DoDrawItem(DRAWITEMSTRUCT *);
 	void DoMeasureItem(MEASUREITEMSTRUCT *);
 	void DoActivate(WPARAM);
@@ -271,7 +458,21 @@ private:
 	int InitCodePageMenu(HMENU, int);
 	void ChooseIdiom();
 	BSTR Transcode(BSTR) const;
-	BSTR ReadLine(DWORD) const;
+	bool GetLine(ULONGLONG, LineData &) const;
+	bool Peek(ULONGLONG) const;
+	ULONGLONG FindLine(ULONGLONG) const;
+	ULONGLONG Reconcile(ULONGLONG);
+	ULONGLONG EstimateLines() const;
+	BSTR ReadOctets(ULONGLONG) const;
+	BSTR ReadLine(ULONGLONG) const;
+	BSTR ExpandPlain(BSTR) const;
+	UINT FindBoundary(BYTE const *, UINT) const;
+	BSTR DecodeColumns(ULONGLONG, UINT, UINT, bool &) const;
+	ColumnIndex::Checkpoint const *IndexColumns(ULONGLONG, ULONGLONG, UINT, UINT &);
+	bool ReadColumns(ULONGLONG, UINT, UINT, BSTR &, UINT &, UINT &);
+	BYTE const *MapLine(ULONGLONG, DWORD &) const;
+	void PreloadVisibleLines() const;
+	bool IsPlainSpan(BYTE const *, DWORD, bool tabs) const;
 	void CopySelectionToClipboard();
 	void SetEncodingInfoFromName(char *);
 
@@ -286,15 +487,48 @@ private:
 	static void CALLBACK DrawMenuDropdown(DRAWITEMSTRUCT *);
 	static void CALLBACK DrawMenuCheckbox(DRAWITEMSTRUCT *);
 
+	// A byte range of the file which a thread of its own indexes in parallel
+	struct Range
+	{
+		MainWindow *owner;
+		HANDLE thread;
+		ULONGLONG begin;
+		ULONGLONG end;
+		LineIndex index;
+		LineStats stats;
+	};
+
+	// How IndexLines() is to treat the octets it reads first
+	enum Start { START_LINE, SKIP_LINE, CONTINUE_LINE };
+
+	void StartThread(LPTHREAD_START_ROUTINE);
 	DWORD ReadThread();
 	static DWORD WINAPI StartReadThread(LPVOID);
+	DWORD TailThread();
+	static DWORD WINAPI StartTailThread(LPVOID);
+	DWORD IndexRange(Range *);
+	static DWORD WINAPI StartIndexRange(LPVOID);
+	bool GetDelimiter(wchar_t &) const;
+	UINT EncodeTerminator(BYTE *) const;
+	void ApplyTerminator(LineReader &) const;
+	bool EndsWithTerminator(char const *, size_t) const;
+	void IndexLines(LineReader &, ULONGLONG, ULONGLONG, LineIndex &, LineStats &, Start);
+	void ContinueLine(LineReader &, ULONGLONG &, LineIndex &);
+	void AppendRange(Range &);
+	void Watch();
+	void Unwatch();
+	DWORD WatchThread();
+	static DWORD WINAPI StartWatchThread(LPVOID);
+	void Follow();
 
-	LineData *Reserve(WORD);
-	LineData *GetAt(DWORD) const;
 	HANDLE Open(LPCTSTR);
 	void Close();
+	bool GetIndexPath(LPTSTR) const;
+	ULONGLONG LoadIndex(HANDLE);
+	void SaveIndex(HANDLE);
 
 	static const UINT ReadThreadFinishedTimer = 1;
+	static const UINT FileChangedTimer = 2;
 
 	HWND m_hwnd;
 	LONG_PTR m_super;
@@ -311,20 +545,57 @@ private:
 	LONG m_refcount;
 	HANDLE m_thread;
 	HANDLE m_handle; // Handle to current file
-	LineData **m_index;
+	mutable PageCache m_pagecache; // pages of m_handle as read for display
+	LineCache m_linecache; // lines as decoded for display
+	ColumnIndex m_columnindex; // checkpoints within long lines as drawn
+	mutable FileView m_fileview; // view of m_handle while painting or copying
+	Prefetcher m_prefetcher; // reads pages into m_pagecache ahead of scrolling
+	HANDLE m_watcher; // Thread which watches the current file in follow mode
+	HANDLE m_unwatch; // Event which tells m_watcher to terminate
+	LineIndex m_index;
+	LineStats m_stats;
+	// Lines of a sparse index as most recently rescanned, by span
+	struct Rescan
+	{
+		ULONGLONG first;
+		ULONGLONG end; // where the span ended as of rescanning it
+		UINT count; // number of lines in the span
+		UINT found; // number of lines located, which is less if the span is too long
+		LineData lines[1]; // followed by room for the lengths to rescan into
+	};
+	mutable Rescan *m_rescans[16];
+	// Lines around where the view has gone ahead of indexing, and the number
+	// of the first of them, which is an estimate unless m_peekexact
+	mutable LineIndex m_peek;
+	mutable ULONGLONG m_peekline;
+	mutable bool m_peekexact;
 	bool m_stop;
 	DWORD m_then;
-	UINT m_lines;
+	ULONGLONG m_indexed; // offset up to which the file has been indexed
+	LONGLONG volatile m_pending; // lines indexed but not yet appended to m_index
+	HANDLE m_cache; // Handle to file through which the index persists
+	ULONGLONG m_cacheblock; // offset of the last block within m_cache
+	ULONGLONG m_cachelines; // number of lines as loaded from m_cache
+	ULONGLONG m_cachesize; // extent of file as covered by m_cache
 	UINT m_width;
 	UINT m_offset;
+	int m_lasttop; // top index as of the most recent paint
+	UINT m_prefetchscreens; // how many pages of lines to read ahead of scrolling
 	UINT m_tabwidth;
 	UINT m_codepage;
 	UINT m_tabwidth_backup;
 	UINT m_codepage_backup;
+	DWORD m_identity[4]; // octets below 0x80 which m_codepage maps to themselves
+	UINT m_charsize; // most octets per character in m_codepage, or 0 if unknown
+	DecodeTable m_decodetable;
+	bool m_singlebyte; // whether m_decodetable holds what m_codepage decodes to
 	LineReader::Encoding m_encoding;
 	EncodingInfo const *m_encodinginfo;
 	EncodingInfo m_genericencodinginfo;
 	char m_delimiter;
+	// Octets which end a record, of which m_delimiter is the last one
+	char m_terminator[LineReader::MaxDelimiter / 2];
+	UINT m_terminatorlength;
 	LONG m_right;
 	LONG m_left;
 	POINT m_fixpoint;
@@ -346,12 +617,22 @@ MainWindow::MainWindow(LPTSTR arg)
 	, m_refcount(0)
 	, m_thread(NULL)
 	, m_handle(INVALID_HANDLE_VALUE)
-	, m_index(NULL)
+	, m_watcher(NULL)
+	, m_peekline(0)
+	, m_peekexact(false)
+	, m_unwatch(NULL)
 	, m_stop(false)
 	, m_then(0)
-	, m_lines(0)
+	, m_indexed(0)
+	, m_pending(0)
+	, m_cache(INVALID_HANDLE_VALUE)
+	, m_cacheblock(0)
+	, m_cachelines(0)
+	, m_cachesize(0)
 	, m_width(0)
 	, m_offset(0)
+	, m_lasttop(0)
+	, m_prefetchscreens(0)
 	, m_tabwidth(8)
 	, m_tabwidth_backup(m_tabwidth)
 	, m_codepage(CP_ACP)
@@ -359,8 +640,14 @@ MainWindow::MainWindow(LPTSTR arg)
 	, m_encoding(LineReader::NONE)
 	, m_encodinginfo(NULL)
 	, m_delimiter('\n')
+	, m_terminatorlength(1)
 {
 	m_path[0] = _T('\0');
+	m_terminator[0] = m_delimiter;
+	ZeroMemory(m_rescans, sizeof m_rescans);
+	MapIdentity(m_codepage, m_identity);
+	m_charsize = MaxCharSize(m_codepage);
+	m_singlebyte = LoadDecodeTable(m_codepage, m_decodetable);
 
 	while (size_t len = PathGetArgs(arg) - arg)
 	{
@@ -381,6 +668,16 @@ MainWindow::MainWindow(LPTSTR arg)
 				mode = MAKEWORD(LineReader::NONE, '>');
 			m_encoding = static_cast<LineReader::Encoding>(LOBYTE(mode));
 			m_delimiter = static_cast<char>(HIBYTE(mode));
+			m_terminator[0] = m_delimiter;
+			m_terminatorlength = 1;
+		}
+		else if (LPCTSTR option = EatPrefix(arg, _T("/DELIMITER=")))
+		{
+			if (UINT length = ParseTerminator(m_terminator, _countof(m_terminator), option))
+			{
+				m_terminatorlength = length;
+				m_delimiter = m_terminator[length - 1];
+			}
 		}
 		else if (LPCTSTR option = EatPrefix(arg, _T("/TABWIDTH=")))
 		{
@@ -449,6 +746,14 @@ void MainWindow::Init(HWND hwnd)
 		mii.dwItemData = reinterpret_cast<ULONG_PTR>(DrawMenuCheckbox);
 	}
 
+	m_pagecache.setCapacity(GetPrivateProfileInt(_T("Settings"), _T("PageCache"), 4, IniPath) * (0x100000 / PageCache::PageSize));
+	m_prefetchscreens = GetPrivateProfileInt(_T("Settings"), _T("PrefetchScreens"), 4, IniPath);
+
+	// Have indexes spill to temporary files beyond IndexBudget MB
+	Arena::configure(
+		static_cast<ULONGLONG>(GetPrivateProfileInt(_T("Settings"), _T("IndexBudget"), 0, IniPath)) << 20,
+		GetPrivateProfileInt(_T("Settings"), _T("LargePages"), 0, IniPath) != 0);
+
 	if (GetPrivateProfileInt(_T("Settings"), _T("UseAgrep"), 0, IniPath))
 	{
 		CheckMenuItem(m_menu, IDM_USE_AGREP, MF_CHECKED);
@@ -555,8 +860,22 @@ BSTR MainWindow::Transcode(BSTR text) const
 	default:
 		if (BSTR wide = SysAllocStringLen(NULL, count))
 		{
-			DWORD const flags = (m_codepage != CP_UTF7) && (m_codepage != CP_UTF8) ? MB_USEGLYPHCHARS : 0;
-			count = MultiByteToWideChar(m_codepage, flags, reinterpret_cast<LPSTR>(text), count, wide, count);
+			BYTE const *const octets = reinterpret_cast<BYTE const *>(text);
+			unsigned short *const units = reinterpret_cast<unsigned short *>(wide);
+			size_t done = 0;
+			size_t length = 0;
+			if (m_singlebyte)
+				done = length = DecodeSingleByte(octets, count, &m_decodetable, units);
+			else if (m_codepage == CP_UTF8)
+				done = DecodeUTF8(octets, count, units, &length);
+			// Leave whatever the decoders won't handle to the system
+			if (done < count)
+			{
+				DWORD const flags = (m_codepage != CP_UTF7) && (m_codepage != CP_UTF8) ? MB_USEGLYPHCHARS : 0;
+				length += MultiByteToWideChar(m_codepage, flags, reinterpret_cast<LPSTR>(text) + done,
+					static_cast<int>(count - done), wide + length, static_cast<int>(count - length));
+			}
+			count = static_cast<UINT>(length);
 			SysReAllocStringLen(&wide, NULL, count);
 			SysFreeString(text);
 			text = wide;
@@ -571,15 +890,253 @@ BSTR MainWindow::Transcode(BSTR text) const
 	return text;
 }
 
-BSTR MainWindow::ReadLine(DWORD dw) const
+// Rescanning a span of a sparse index goes no further than this many octets
+static ULONGLONG const RescanLimit = 0x1000000;
+
+/**
+ * @brief Locates line i, which involves rescanning the span it belongs to if
+ * the index is sparse. Lines beyond RescanLimit octets into the span remain
+ * unknown, so as not to hold up drawing on spans of very long lines.
+ */
+bool MainWindow::GetLine(ULONGLONG i, LineData &linedata) const
+{
+	if (i >= m_index.size())
+		return (i - m_peekline < m_peek.size() || Peek(i)) && m_peek.getAt(i - m_peekline, linedata);
+	UINT const interval = m_index.interval();
+	if (interval == 1)
+		return m_index.getAt(i, linedata);
+	LineData span;
+	ULONGLONG first;
+	if (!m_index.getSpan(i, span, first))
+		return false;
+	ULONGLONG const left = m_index.size() - first;
+	UINT const count = left < interval ? static_cast<UINT>(left) : interval;
+	Rescan *&rescan = m_rescans[first / interval % _countof(m_rescans)];
+	// The last span may have grown since it was rescanned
+	if (rescan == NULL || rescan->first != first || rescan->count != count ||
+		first + count == m_index.size() && rescan->end != m_index.getExtent(0))
+	{
+		if (rescan == NULL)
+		{
+			rescan = static_cast<Rescan *>(CoTaskMemAlloc(offsetof(Rescan, lines) + interval * (sizeof(LineData) + sizeof(UINT))));
+			if (rescan == NULL)
+				return false;
+		}
+		UINT *const lengths = reinterpret_cast<UINT *>(rescan->lines + interval);
+		// Stop at the next span, or at RescanLimit, whichever comes first
+		LineData next;
+		ULONGLONG following;
+		ULONGLONG const bound = m_index.getSpan(first + interval, next, following) ? next.offset : m_index.getExtent(0);
+		bool const capped = bound - span.offset > RescanLimit;
+		size_t n = 0;
+		// The reader is too large to live on the stack of the UI thread
+		if (LineReader *const reader = new(std::nothrow) LineReader(m_handle))
+		{
+			ApplyTerminator(*reader);
+			reader->setEnd(capped ? span.offset + RescanLimit : bound);
+			if (reader->seek(span.offset))
+			{
+				wchar_t eol;
+				n = GetDelimiter(eol) ?
+					reader->readLinesWide(lengths, count, LineIndex::LengthLimit, eol) :
+					reader->readLinesAnsi(lengths, count, LineIndex::LengthLimit, static_cast<char>(eol));
+				// A line which the limit cuts short is yet to be located
+				if (capped && n != 0 && !reader->lastLineDelimited())
+					--n;
+			}
+			delete reader;
+		}
+		ULONGLONG offset = span.offset;
+		for (size_t j = 0; j < n; ++j)
+		{
+			rescan->lines[j].offset = offset;
+			offset += rescan->lines[j].len = lengths[j];
+		}
+		rescan->first = first;
+		rescan->end = bound;
+		rescan->count = count;
+		rescan->found = static_cast<UINT>(n);
+		if (n != count && !capped)
+			rescan->first = ~0ULL; // file has changed, so don't keep this
+	}
+	if (i - first >= rescan->found)
+		return false;
+	linedata = rescan->lines[i - first];
+	return true;
+}
+
+// Peeking skips no more than this many octets to find the start of a line
+static ULONGLONG const PeekSkipLimit = 0x40000;
+
+/**
+ * @brief Indexes the lines around where line i is estimated to reside, so as
+ * to show them while the sequential pass is still on its way. The estimate
+ * extrapolates from the average length of the lines indexed so far.
+ */
+bool MainWindow::Peek(ULONGLONG i) const
+{
+	ULONGLONG const lines = m_index.size();
+	ULONGLONG const extent = m_index.getExtent(0);
+	LineData span;
+	ULONGLONG first;
+	LARGE_INTEGER size;
+	if (m_thread == NULL || !m_index.getSpan(0, span, first) || extent <= span.offset ||
+		!GetFileSizeEx(m_handle, &size) || static_cast<ULONGLONG>(size.QuadPart) <= extent)
+	{
+		return false;
+	}
+	ULONGLONG const end = static_cast<ULONGLONG>(size.QuadPart);
+	// Lines past those which reach the end of the file don't exist
+	if (m_peek.getExtent(0) == end && i >= m_peekline)
+		return false;
+	double const average = static_cast<double>(extent - span.offset) / lines;
+	double const estimate = static_cast<double>(extent) + static_cast<double>(i - lines) * average;
+	ULONGLONG const offset = estimate < static_cast<double>(end) ? static_cast<ULONGLONG>(estimate) : end - 1;
+	wchar_t eol;
+	bool const wide = GetDelimiter(eol);
+	UINT const unit = wide ? 2 : 1;
+	// Back off a bit to have some lines before line i, too
+	ULONGLONG start = offset - extent > 0x40000 ? offset - 0x40000 : extent;
+	if (wide)
+		start &= ~1ULL;
+	m_peek.clear();
+	LineReader reader(m_handle);
+	ApplyTerminator(reader);
+	// Like a range, start on the code unit before, and skip up to a delimiter
+	if (!reader.seek(start > extent ? start - unit : start))
+		return false;
+	UINT const limit = LineIndex::LengthLimit;
+	ULONGLONG pos = start;
+	bool skip = start > extent;
+	if (skip)
+		pos -= unit;
+	// Give up on a line too long to skip while drawing, rather than read as
+	// much as 4GB to find its end
+	ULONGLONG const bound = pos + PeekSkipLimit;
+	while (skip)
+	{
+		if (pos >= bound)
+			return false;
+		size_t const n = wide ?
+			reader.readLineWide(static_cast<size_t>(bound - pos), eol) :
+			reader.readLineAnsi(static_cast<size_t>(bound - pos), static_cast<char>(eol));
+		if (n == 0)
+			return false;
+		pos += n;
+		skip = !reader.lastLineDelimited();
+	}
+	// Index up to a bit beyond, and count the lines before the one in which
+	// offset lies, so as to number that one as line i
+	ULONGLONG before = 0;
+	UINT lengths[0x400];
+	while (pos <= offset + 0x40000 && m_peek.size() < 0x10000)
+	{
+		size_t const count = _countof(lengths);
+		size_t const n = wide ?
+			reader.readLinesWide(lengths, count, limit, eol) :
+			reader.readLinesAnsi(lengths, count, limit, static_cast<char>(eol));
+		if (n == 0 || m_peek.append(pos, lengths, static_cast<UINT>(n)) < n)
+			break;
+		for (size_t j = 0; j < n; ++j)
+		{
+			pos += lengths[j];
+			if (pos <= offset)
+				++before;
+		}
+		if (n < count)
+			break;
+	}
+	if (m_peek.size() == 0)
+		return false;
+	if (before >= m_peek.size())
+		before = m_peek.size() - 1;
+	// Don't let numbers overlap with those of lines already indexed
+	m_peekline = i - before > lines ? i - before : lines;
+	m_peekexact = false;
+	return i - m_peekline < m_peek.size();
+}
+
+/**
+ * @brief Finds the number of the line which starts at offset, or otherwise of
+ * the line in which offset lies, among the lines indexed so far.
+ */
+ULONGLONG MainWindow::FindLine(ULONGLONG offset) const
+{
+	ULONGLONG i = m_index.find(offset);
+	// In a sparse index, walk the span from its first line on
+	LineData linedata;
+	while (i + 1 < m_index.size() && GetLine(i + 1, linedata) && linedata.offset <= offset)
+		++i;
+	return i;
+}
+
+/**
+ * @brief Replaces the estimated numbers of the peeked lines with the exact
+ * ones once the sequential pass has arrived there, and drops the peeked lines
+ * once the sequential pass has gone beyond them.
+ * @param [in] top Number of the line at the top of the view.
+ * @return Number of the line to bring to the top of the view so that it keeps
+ * showing the same lines.
+ */
+ULONGLONG MainWindow::Reconcile(ULONGLONG top)
+{
+	LineData first;
+	if (m_peek.getAt(0, first))
+	{
+		ULONGLONG const extent = m_index.getExtent(0);
+		if (!m_peekexact && extent > first.offset)
+		{
+			ULONGLONG const line = FindLine(first.offset);
+			if (top - m_peekline < m_peek.size())
+				top = top - m_peekline + line;
+			m_peekline = line;
+			m_peekexact = true;
+		}
+		if (m_thread == NULL || extent >= m_peek.getExtent(0))
+			m_peek.clear();
+	}
+	return top;
+}
+
+/**
+ * @brief Estimates the number of lines in the file while indexing, so as to
+ * let the view move ahead of the sequential pass. Once indexing has finished,
+ * the number is exact.
+ */
+ULONGLONG MainWindow::EstimateLines() const
+{
+	ULONGLONG lines = m_index.size();
+	ULONGLONG const extent = m_index.getExtent(0);
+	LineData span;
+	ULONGLONG first;
+	LARGE_INTEGER size;
+	if (m_thread != NULL && m_index.getSpan(0, span, first) && extent > span.offset &&
+		GetFileSizeEx(m_handle, &size) && static_cast<ULONGLONG>(size.QuadPart) > extent)
+	{
+		double const average = static_cast<double>(extent - span.offset) / lines;
+		lines += static_cast<ULONGLONG>(static_cast<double>(size.QuadPart - extent) / average);
+		if (m_peek.size() != 0 && lines < m_peekline + m_peek.size())
+			lines = m_peekline + m_peek.size();
+	}
+	return lines;
+}
+
+// Lines are no longer split at 16MB, so read no more than that of any line
+static DWORD const ReadLimit = 0x1000000;
+
+/**
+ * @brief Reads line i as it is in the file, with no transcoding, up to
+ * ReadLimit octets.
+ */
+BSTR MainWindow::ReadOctets(ULONGLONG i) const
 {
-	BSTR wide = NULL;
-	if (LineData *linedata = GetAt(dw))
+	BSTR text = NULL;
+	LineData linedata;
+	if (GetLine(i, linedata))
 	{
 		LARGE_INTEGER pos;
-		pos.LowPart = linedata->LowPart;
-		pos.HighPart = linedata->HighPart;
-		DWORD count = linedata->len;
+		pos.QuadPart = static_cast<LONGLONG>(linedata.offset);
+		DWORD count = linedata.len < ReadLimit ? linedata.len : ReadLimit;
 		switch (m_codepage)
 		{
 		case 1200:
@@ -589,16 +1146,117 @@ BSTR MainWindow::ReadLine(DWORD dw) const
 				++count;
 			break;
 		}
-		SetFilePointerEx(m_handle, pos, NULL, FILE_BEGIN);
-		if (BSTR text = SysAllocStringByteLen(NULL,  count))
+		if ((text = SysAllocStringByteLen(NULL,  count)) != NULL)
+			m_pagecache.read(m_handle, pos.QuadPart, text, count);
+	}
+	return text;
+}
+
+BSTR MainWindow::ReadLine(ULONGLONG i) const
+{
+	BSTR text = ReadOctets(i);
+	return text ? Transcode(text) : NULL;
+}
+
+/**
+ * @brief Widens a line whose octets m_codepage maps to themselves, and expands
+ * its tabs to m_tabwidth along the way, in a single pass.
+ * @return The line as it is to be drawn, or NULL if it has octets which need
+ * actual transcoding, in which case octets is left as it is.
+ */
+BSTR MainWindow::ExpandPlain(BSTR octets) const
+{
+	BYTE const *const p = reinterpret_cast<BYTE const *>(octets);
+	UINT const n = SysStringByteLen(octets);
+	UINT capacity = n;
+	BSTR wide = SysAllocStringLen(NULL, capacity);
+	UINT i = 0;
+	size_t w = 0;
+	while (wide != NULL)
+	{
+		i += static_cast<UINT>(ExpandIdentity(p + i, n - i, m_identity, m_tabwidth, wide, capacity, &w));
+		if (i == n)
+		{
+			SysReAllocStringLen(&wide, NULL, static_cast<UINT>(w));
+			break;
+		}
+		if (p[i] != '\t')
+		{
+			SysFreeString(wide);
+			wide = NULL;
+			break;
+		}
+		// Make room for the tab which didn't fit, and the octets after it
+		capacity = static_cast<UINT>(w) + m_tabwidth + (n - i) + capacity / 2;
+		if (!SysReAllocStringLen(&wide, NULL, capacity))
 		{
-			ReadFile(m_handle, text, count, &count, NULL);
-			wide = Transcode(text);
+			SysFreeString(wide);
+			wide = NULL;
 		}
 	}
 	return wide;
 }
 
+/**
+ * @brief Maps line i for direct access, with the same adjustments as
+ * ReadLine() makes. The octets remain accessible until m_fileview moves on
+ * or gets closed.
+ */
+BYTE const *MainWindow::MapLine(ULONGLONG i, DWORD &count) const
+{
+	LineData linedata;
+	if (!GetLine(i, linedata))
+		return NULL;
+	ULONGLONG offset = linedata.offset;
+	count = linedata.len < ReadLimit ? linedata.len : ReadLimit;
+	if (m_codepage == 1200)
+	{
+		if (offset & 1)
+			++offset;
+		if (count & 1)
+			++count;
+	}
+	return m_fileview.map(m_handle, offset, count);
+}
+
+/**
+ * @brief Has the page cache read the lines in view with a single I/O, ahead of
+ * drawing them one by one, as they are contiguous in the file. This also
+ * brings them into the system cache for the sake of MapLine().
+ */
+void MainWindow::PreloadVisibleLines() const
+{
+	if (m_handle == INVALID_HANDLE_VALUE)
+		return;
+	int const top = ListView_GetTopIndex(m_hwndList);
+	int last = top + ListView_GetCountPerPage(m_hwndList);
+	int const count = ListView_GetItemCount(m_hwndList);
+	if (last >= count)
+		last = count - 1;
+	LineData lower, upper;
+	if (top <= last && GetLine(top, lower) && GetLine(last, upper) && upper.offset + upper.len > lower.offset)
+	{
+		ULONGLONG const span = upper.offset + upper.len - lower.offset;
+		if (span < ReadLimit)
+			m_pagecache.preload(m_handle, lower.offset, static_cast<DWORD>(span));
+	}
+}
+
+/**
+ * @brief Tells whether m_codepage maps each of count octets to itself, and
+ * therefore whether they can be used as they are.
+ */
+bool MainWindow::IsPlainSpan(BYTE const *octets, DWORD count, bool tabs) const
+{
+	for (DWORD i = 0; i < count; ++i)
+	{
+		BYTE const c = octets[i];
+		if (c >= 0x80 || !(m_identity[c >> 5] & (1UL << (c & 31))) || (c == '\t' && !tabs))
+			return false;
+	}
+	return true;
+}
+
 void MainWindow::CopySelectionToClipboard()
 {
 	if (OpenClipboard(m_hwnd))
@@ -615,14 +1273,43 @@ void MainWindow::CopySelectionToClipboard()
 					MessageBox(m_hwnd, _T("Data beyond 4MB has been truncated!"), _T("Clipboard"), MB_ICONWARNING);
 					break;
 				}
-				if (BSTR text = ReadLine(i))
+				// Lines get read up to ReadLimit, so tell when that cuts one short
+				LineData linedata;
+				if (GetLine(i, linedata) && linedata.len > ReadLimit)
+				{
+					TCHAR text[80];
+					wsprintf(text, _T("Line %d has been truncated to 16MB!"), i + 1);
+					MessageBox(m_hwnd, text, _T("Clipboard"), MB_ICONWARNING);
+				}
+				// Copy UCS2LE and plain ASCII right from the file view
+				DWORD count = 0;
+				BYTE const *const octets = MapLine(i, count);
+				if (octets != NULL && m_codepage == 1200)
+				{
+					pstm->Write(octets, count, NULL);
+					total += count;
+				}
+				else if (octets != NULL && IsPlainSpan(octets, count, true))
+				{
+					WCHAR wide[1024];
+					for (DWORD j = 0; j < count; j += _countof(wide))
+					{
+						DWORD const n = count - j < _countof(wide) ? count - j : _countof(wide);
+						for (DWORD k = 0; k < n; ++k)
+							wide[k] = octets[j + k];
+						pstm->Write(wide, n * sizeof *wide, NULL);
+					}
+					total += count * sizeof *wide;
+				}
+				else if (BSTR text = ReadLine(i))
 				{
-					DWORD count = SysStringByteLen(text);
+					count = SysStringByteLen(text);
 					pstm->Write(text, count, NULL);
 					total += count;
 					SysFreeString(text);
 				}
 			}
+			m_fileview.close();
 			pstm->Write(L"", sizeof(wchar_t), NULL);
 			HGLOBAL hGlobal = NULL;
 			if (EmptyClipboard() && SUCCEEDED(GetHGlobalFromStream(pstm, &hGlobal)) && !SetClipboardData(CF_UNICODETEXT, hGlobal))
@@ -669,9 +1356,12 @@ static void GetCellRect(HWND hwnd, int iItem, int iSubItem, RECT &rc)
 	rc.right = rch.right;
 }
 
-UINT UnwrapLine(LPWSTR text, UINT n)
+/**
+ * @brief Joins the physical lines of a record, collapsing whitespace, taking
+ * text to start at column, and carrying eat on from what precedes it.
+ */
+UINT UnwrapLine(LPWSTR text, UINT n, bool &eat, UINT column)
 {
-	bool eat = true;
 	UINT w = 0;
 	for (UINT i = 0; i < n; ++i)
 	{
@@ -679,7 +1369,7 @@ UINT UnwrapLine(LPWSTR text, UINT n)
 		{
 		case '\n':
 			eat = true;
-			if (w != 0)
+			if (column + w != 0)
 				text[w++] = ' ';
 			// fall through
 		case '\r':
@@ -698,6 +1388,161 @@ UINT UnwrapLine(LPWSTR text, UINT n)
 	return w;
 }
 
+// Lines of this many octets or more are decoded only as far as they are in view
+static UINT const LongLine = 0x40000;
+// Distance between checkpoints within long lines, in octets
+static UINT const CheckpointInterval = 0x10000;
+
+/**
+ * @brief Finds where decoding in m_codepage may start afresh, searching back
+ * from n, which requires the octet at n to be readable.
+ * @return Offset of that place, or 0 if there is none.
+ */
+UINT MainWindow::FindBoundary(BYTE const *p, UINT n) const
+{
+	switch (m_codepage)
+	{
+	case 1200: // UCS2LE
+	case 1201: // UCS2BE
+		return n & ~1U;
+	case CP_UTF8:
+		while (n != 0 && (p[n] & 0xC0) == 0x80)
+			--n;
+		return n;
+	}
+	switch (m_charsize)
+	{
+	case 1:
+		return n;
+	case 2:
+		// No trail octet of any double byte code page falls below 0x31
+		while (n != 0 && p[n - 1] >= 0x31)
+			--n;
+		return n;
+	}
+	return 0;
+}
+
+/**
+ * @brief Reads count octets from offset on, where decoding may start afresh,
+ * and makes them look as they do on screen from column on.
+ */
+BSTR MainWindow::DecodeColumns(ULONGLONG offset, UINT count, UINT column, bool &eat) const
+{
+	BSTR text = SysAllocStringByteLen(NULL, count);
+	if (text == NULL)
+		return NULL;
+	m_pagecache.read(m_handle, offset, text, count);
+	if ((text = Transcode(text)) == NULL)
+		return NULL;
+	if (m_delimiter != '\n' || m_terminatorlength > 1)
+		SysReAllocStringLen(&text, NULL, UnwrapLine(text, SysStringLen(text), eat, column));
+	else
+		text = ExpandTabs(text, m_tabwidth, column);
+	return text;
+}
+
+/**
+ * @brief Decodes a long line once through, and sets checkpoints within it at
+ * intervals of about CheckpointInterval octets.
+ * @return The checkpoints, or NULL if the code page doesn't allow for them.
+ */
+ColumnIndex::Checkpoint const *MainWindow::IndexColumns(ULONGLONG line, ULONGLONG start, UINT len, UINT &count)
+{
+	UINT capacity = len / CheckpointInterval + 2;
+	ColumnIndex::Checkpoint *checkpoints = static_cast<ColumnIndex::Checkpoint *>(
+		CoTaskMemAlloc(capacity * sizeof *checkpoints));
+	BYTE *const buffer = static_cast<BYTE *>(CoTaskMemAlloc(CheckpointInterval + 1));
+	UINT offset = 0;
+	UINT column = 0;
+	bool eat = true;
+	count = 0;
+	while (checkpoints != NULL && buffer != NULL)
+	{
+		if (count == capacity)
+		{
+			capacity *= 2;
+			void *const grown = CoTaskMemRealloc(checkpoints, capacity * sizeof *checkpoints);
+			if (grown == NULL)
+			{
+				CoTaskMemFree(checkpoints);
+				checkpoints = NULL;
+				break;
+			}
+			checkpoints = static_cast<ColumnIndex::Checkpoint *>(grown);
+		}
+		checkpoints[count].offset = offset;
+		checkpoints[count].column = column;
+		checkpoints[count].eat = eat;
+		++count;
+		if (offset == len)
+			break;
+		UINT chunk = len - offset;
+		if (chunk > CheckpointInterval)
+		{
+			// Read one octet more, which UTF-8 needs to tell where characters start
+			chunk = m_pagecache.read(m_handle, start + offset, buffer, CheckpointInterval + 1) > CheckpointInterval ?
+				FindBoundary(buffer, CheckpointInterval) : 0;
+		}
+		BSTR const text = chunk != 0 ? DecodeColumns(start + offset, chunk, column, eat) : NULL;
+		if (text == NULL)
+		{
+			CoTaskMemFree(checkpoints);
+			checkpoints = NULL;
+			break;
+		}
+		column += SysStringLen(text);
+		SysFreeString(text);
+		offset += chunk;
+	}
+	CoTaskMemFree(buffer);
+	if (checkpoints != NULL)
+		m_columnindex.insert(line, checkpoints, count);
+	return checkpoints;
+}
+
+/**
+ * @brief Decodes the span columns of a long line from column on, or a little
+ * more, as established by the line's checkpoints.
+ * @param [out] text Columns from base on, or NULL if column is past the end.
+ * @param [out] width Width of the line.
+ * @return Whether the line is long enough and lends itself to that.
+ */
+bool MainWindow::ReadColumns(ULONGLONG line, UINT column, UINT span, BSTR &text, UINT &base, UINT &width)
+{
+	LineData linedata;
+	if (!GetLine(line, linedata) || linedata.len < LongLine)
+		return false;
+	// Same adjustments as in ReadOctets()
+	ULONGLONG start = linedata.offset;
+	UINT len = linedata.len < ReadLimit ? linedata.len : ReadLimit;
+	if (m_codepage == 1200)
+	{
+		if (start & 1)
+			++start;
+		if (len & 1)
+			++len;
+	}
+	UINT count = 0;
+	ColumnIndex::Checkpoint const *checkpoints = m_columnindex.lookup(line, count);
+	if (checkpoints == NULL && (checkpoints = IndexColumns(line, start, len, count)) == NULL)
+		return false;
+	width = checkpoints[count - 1].column;
+	base = width;
+	text = NULL;
+	if (column < width)
+	{
+		UINT const i = ColumnIndex::find(checkpoints, count, column);
+		UINT j = i + 1;
+		while (j + 1 < count && checkpoints[j].column < column + span)
+			++j;
+		bool eat = checkpoints[i].eat;
+		base = checkpoints[i].column;
+		text = DecodeColumns(start + checkpoints[i].offset, checkpoints[j].offset - checkpoints[i].offset, base, eat);
+	}
+	return true;
+}
+
 LRESULT MainWindow::DoCustomDraw(NMLVCUSTOMDRAW *pnm)
 {
 	RECT rc;
@@ -705,14 +1550,14 @@ LRESULT MainWindow::DoCustomDraw(NMLVCUSTOMDRAW *pnm)
 	switch (pnm->nmcd.dwDrawStage)
 	{
 	case CDDS_PREPAINT:
+		PreloadVisibleLines();
 		return CDRF_NOTIFYITEMDRAW | CDRF_NOTIFYPOSTPAINT;
 
 	case CDDS_ITEM | CDDS_PREPAINT:
 		{
 			UINT state = ListView_GetItemState(m_hwndList, pnm->nmcd.dwItemSpec, LVIS_SELECTED);
-			LineData const *const linedata = GetAt(static_cast<DWORD>(pnm->nmcd.dwItemSpec));
 			COLORREF bkgnd = GetSysColor(COLOR_WINDOW);
-			COLORREF color = linedata && (linedata->flags & 1) ? RGB(255, 0, 0) : GetSysColor(COLOR_WINDOWTEXT);
+			COLORREF color = m_index.isMatch(pnm->nmcd.dwItemSpec) ? RGB(255, 0, 0) : GetSysColor(COLOR_WINDOWTEXT);
 			if (m_hwndList != GetFocus())
 			{
 				if (state & LVIS_SELECTED)
@@ -738,7 +1583,10 @@ LRESULT MainWindow::DoCustomDraw(NMLVCUSTOMDRAW *pnm)
 				rc.right = m_right;
 
 				WCHAR text[12];
-				DWORD count = wsprintfW(text, L"%u", pnm->nmcd.dwItemSpec + 1);
+				// Mark the estimated numbers of lines ahead of indexing
+				DWORD count = wsprintfW(text,
+					pnm->nmcd.dwItemSpec < m_index.size() || m_peekexact ? L"%u" : L"~%u",
+					pnm->nmcd.dwItemSpec + 1);
 
 				SIZE ext;
 				GetTextExtentPoint32(pnm->nmcd.hdc, L"", 1, &ext);
@@ -750,35 +1598,111 @@ LRESULT MainWindow::DoCustomDraw(NMLVCUSTOMDRAW *pnm)
 
 		case 1:
 			{
-				BSTR text = ReadLine(static_cast<DWORD>(pnm->nmcd.dwItemSpec));
-
-				UINT const width = m_delimiter != '\n' ?
-					UnwrapLine(text, SysStringLen(text)) :
-					SysStringLen(text = ExpandTabs(text, m_tabwidth));
+				ULONGLONG const line = pnm->nmcd.dwItemSpec;
+				UINT width = 0;
+				BSTR text = m_linecache.lookup(line, width);
+				BSTR uncached = NULL;
+				LPCWSTR wide = text;
+				LPCSTR ascii = NULL;
+				// Long lines get decoded only as far as they are in view, so
+				// what is at hand are the columns from base up to limit
+				UINT base = 0;
+				bool const windowed = text == NULL && line + 1 < m_index.size() &&
+					ReadColumns(line, m_offset, ColumnsToFill(pnm->nmcd.hdc, rc.right - rc.left), uncached, base, width);
+				UINT limit = windowed ? base + SysStringLen(uncached) : width;
+				if (windowed)
+					wide = uncached;
+				DWORD len = 0;
+				// Lines which need neither transcoding nor tab expansion are
+				// drawn right from the file view, and are not worth caching
+				BYTE const *const octets = text == NULL && !windowed &&
+					m_delimiter == '\n' && m_terminatorlength == 1 ? MapLine(line, len) : NULL;
+				if (octets != NULL && m_codepage == 1200)
+				{
+					LPCWSTR const span = reinterpret_cast<LPCWSTR>(octets);
+					UINT const n = len / 2;
+					UINT i = 0;
+					while (i < n && span[i] != L'\t')
+						++i;
+					if (i == n)
+					{
+						wide = span;
+						limit = width = n;
+					}
+				}
+				else if (octets != NULL && IsPlainSpan(octets, len, false))
+				{
+					ascii = reinterpret_cast<LPCSTR>(octets);
+					limit = width = len;
+				}
+				if (wide == NULL && ascii == NULL && !windowed)
+				{
+					if (m_delimiter != '\n' || m_terminatorlength > 1)
+					{
+						bool eat = true;
+						text = ReadLine(line);
+						width = UnwrapLine(text, SysStringLen(text), eat, 0);
+					}
+					// Have plain ASCII bypass the code page converter, provided
+					// it maps all of 0x20 through 0x7E to themselves
+					else if ((m_identity[1] & m_identity[2] & (m_identity[3] | 0x80000000UL)) == 0xFFFFFFFFUL &&
+						(text = ReadOctets(line)) != NULL)
+					{
+						if (BSTR const plain = ExpandPlain(text))
+						{
+							SysFreeString(text);
+							text = plain;
+						}
+						else
+						{
+							text = ExpandTabs(Transcode(text), m_tabwidth);
+						}
+						width = SysStringLen(text);
+					}
+					else
+					{
+						text = ReadLine(line);
+						width = SysStringLen(text = ExpandTabs(text, m_tabwidth));
+					}
+					// Lines ahead of indexing are numbered by estimate, and the
+					// last line may yet grow in follow mode, so don't keep them
+					// Lines too long to keep are left to be freed after drawing
+					if (text == NULL || line + 1 >= m_index.size() || !m_linecache.insert(line, text, width))
+						uncached = text;
+					wide = text;
+					limit = width;
+				}
 
 				if (m_width < width)
 					m_width = width;
 
-				if (m_offset < width)
+				if (m_offset >= base && m_offset < limit)
 				{
 					rc.left = m_left;
 
 					SIZE ext;
-					UINT count = width - m_offset;
+					UINT const skip = m_offset - base;
+					UINT count = limit - m_offset;
 					UINT visible = 0;
 					do
 					{
 						visible += 256;
 						if (visible > count)
 							visible = count;
-						GetTextExtentPoint32(pnm->nmcd.hdc, text + m_offset, visible, &ext);
+						if (ascii != NULL)
+							GetTextExtentPoint32A(pnm->nmcd.hdc, ascii + skip, visible, &ext);
+						else
+							GetTextExtentPoint32W(pnm->nmcd.hdc, wide + skip, visible, &ext);
 					} while (ext.cx < rc.right - rc.left && visible < count);
 
 					rc.top += (rc.bottom - rc.top - ext.cy) / 2;
-					ExtTextOutW(pnm->nmcd.hdc, rc.left, rc.top, 0, &rc, text + m_offset, visible, NULL);
+					if (ascii != NULL)
+						ExtTextOutA(pnm->nmcd.hdc, rc.left, rc.top, 0, &rc, ascii + skip, visible, NULL);
+					else
+						ExtTextOutW(pnm->nmcd.hdc, rc.left, rc.top, 0, &rc, wide + skip, visible, NULL);
 				}
 
-				SysFreeString(text);
+				SysFreeString(uncached);
 			}
 			break;
 		}
@@ -796,6 +1720,9 @@ LRESULT MainWindow::DoCustomDraw(NMLVCUSTOMDRAW *pnm)
 		break;
 
 	case CDDS_POSTPAINT:
+		// Don't hold on to the view, which would keep the file from shrinking
+		m_fileview.close();
+		Anticipate();
 		AdjustScrollRange();
 		break;
 	}
@@ -951,7 +1878,10 @@ void MainWindow::Open(WORD mode)
 		ofn.nFilterIndex = 1;
 	}
 	if (GetOpenFileName(&ofn))
+	{
+		m_terminatorlength = 0;
 		Open(path, mode);
+	}
 }
 
 void MainWindow::SelectFont()
@@ -992,8 +1922,16 @@ void MainWindow::UseDefaultFont()
 void MainWindow::SetTabWidth(UINT tabwidth)
 {
 	if (m_tabwidth != tabwidth)
+	{
 		InvalidateRect(m_hwndList, NULL, TRUE);
-	m_tabwidth = tabwidth;
+		m_linecache.clear();
+		m_columnindex.clear();
+		// Start over from the statistics, as lines drawn before were expanded
+		// to the previous tab width
+		m_tabwidth = tabwidth;
+		m_width = 0;
+		AdjustWidth();
+	}
 	if (GetCapture() == NULL)
 		m_tabwidth_backup = m_tabwidth;
 }
@@ -1001,7 +1939,14 @@ void MainWindow::SetTabWidth(UINT tabwidth)
 void MainWindow::SetCodePage(UINT codepage)
 {
 	if (m_codepage != codepage)
+	{
 		InvalidateRect(m_hwndList, NULL, TRUE);
+		m_linecache.clear();
+		m_columnindex.clear();
+		MapIdentity(codepage, m_identity);
+		m_charsize = MaxCharSize(codepage);
+		m_singlebyte = LoadDecodeTable(codepage, m_decodetable);
+	}
 	m_codepage = codepage;
 	if (GetCapture() == NULL)
 		m_codepage_backup = m_codepage;
@@ -1302,6 +2247,7 @@ LRESULT MainWindow::DoMsg(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 		return TRUE;
 
 	case WM_DESTROY:
+		Unwatch();
 		if (m_thread != NULL)
 		{
 			m_stop = true;
@@ -1419,6 +2365,9 @@ LRESULT MainWindow::DoMsg(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 	case WM_TIMER:
 		switch (wParam)
 		{
+		case FileChangedTimer:
+			Follow();
+			break;
 		case ~ReadThreadFinishedTimer:
 			CloseHandle(m_thread);
 			m_thread = NULL;
@@ -1445,14 +2394,25 @@ LRESULT MainWindow::DoMsg(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 				SetCodePage(m_encodinginfo ? m_encodinginfo->cp : CP_ACP);
 				break;
 			}
-			IndicateProgress(m_lines, GetTickCount() - m_then);
+			IndicateProgress(m_index.size() + m_pending, GetTickCount() - m_then);
+			AdjustWidth();
 			int i = ListView_GetTopIndex(m_hwndList);
+			// In follow mode, keep the last line in view if it is in view
+			bool const tail = (GetMenuState(m_menu, IDM_FOLLOW, MF_BYCOMMAND) & MF_CHECKED) &&
+				i + ListView_GetCountPerPage(m_hwndList) >= ListView_GetItemCount(m_hwndList);
 			RECT rc;
 			if (ListView_GetItemRect(m_hwndList, i, &rc, LVIR_BOUNDS))
 				ListView_Scroll(m_hwndList, 0, (rc.top - rc.bottom) * i);
-			ListView_SetItemCount(m_hwndList, m_lines);
+			ULONGLONG const top = Reconcile(i);
+			i = top < INT_MAX ? static_cast<int>(top) : INT_MAX;
+			// The list view holds no more than INT_MAX items
+			ULONGLONG const lines = EstimateLines();
+			int const n = lines < INT_MAX ? static_cast<int>(lines) : INT_MAX;
+			ListView_SetItemCount(m_hwndList, n);
 			if (ListView_GetItemRect(m_hwndList, 0, &rc, LVIR_BOUNDS))
 				ListView_Scroll(m_hwndList, 0, (rc.bottom - rc.top) * i);
+			if (tail && n != 0)
+				ListView_EnsureVisible(m_hwndList, n - 1, FALSE);
 			ListView_SetColumnWidth(m_hwndList, 1, LVSCW_AUTOSIZE_USEHEADER);
 			break;
 		}
@@ -1529,6 +2489,12 @@ LRESULT MainWindow::DoMsg(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 		case IDM_STOP:
 			m_stop = true;
 			break;
+		case IDM_FOLLOW:
+			CheckMenuItem(m_menu, IDM_FOLLOW, GetMenuState(m_menu, IDM_FOLLOW, MF_BYCOMMAND) & MF_CHECKED ^ MF_CHECKED);
+			DrawMenuBar(m_hwnd);
+			Unwatch();
+			Watch();
+			break;
 		case IDM_SELECT_FONT:
 			SelectFont();
 			break;
@@ -1756,16 +2722,108 @@ void MainWindow::UpdateWindowTitle()
 	SetWindowText(m_hwnd, text);
 }
 
-void MainWindow::IndicateProgress(DWORD lines, DWORD elapsed)
-{
-	TCHAR text[128];
-	wsprintf(text, _T("%hs lines / elapsed time: %hs ms%s"), NumToStr(lines), NumToStr(elapsed), &_T("\0 - STOPPED!")[m_stop]);
-	SetWindowText(m_hwndStatus, text);
-}
-
-void MainWindow::AdjustScrollRange()
+void MainWindow::IndicateProgress(ULONGLONG lines, DWORD elapsed)
 {
-	RECT rc;
+	TCHAR text[512];
+	int n = wsprintf(text, _T("%hs lines / elapsed time: %hs ms%s"), NumToStr(lines), NumToStr(elapsed), &_T("\0 - STOPPED!")[m_stop]);
+	if (m_stats.lines() != 0)
+	{
+		n += wsprintf(text + n, _T(" / widest: %hs / 90%% below %hs octets / CRLF: %hs, LF: %hs, CR: %hs / non-ASCII: %hs lines"),
+			NumToStr(m_stats.width(m_tabwidth)), NumToStr(m_stats.percentile(90)),
+			NumToStr(m_stats.crlf()), NumToStr(m_stats.lf()), NumToStr(m_stats.cr()), NumToStr(m_stats.nonascii()));
+	}
+	if (m_pagecache.hits() + m_pagecache.misses() != 0)
+	{
+		n += wsprintf(text + n, _T(" / page cache: %hs hits, %hs misses"),
+			NumToStr(m_pagecache.hits()), NumToStr(m_pagecache.misses()));
+	}
+	FileAccess::Stats const &reads = FileAccess::stats();
+	if (reads.reads != 0)
+	{
+		wsprintf(text + n, _T(" / UI reads: %hs, %hs octets"),
+			NumToStr(reads.reads), NumToStr(reads.octets));
+	}
+	SetWindowText(m_hwndStatus, text);
+}
+
+/**
+ * @brief Widens m_width to what indexing has found so far, unless lines are
+ * unwrapped for display, which the statistics don't account for.
+ */
+void MainWindow::AdjustWidth()
+{
+	if (m_delimiter == '\n' && m_terminatorlength == 1)
+	{
+		UINT const width = m_stats.width(m_tabwidth);
+		if (m_width < width)
+			m_width = width;
+	}
+	AdjustScrollRange();
+}
+
+/**
+ * @brief Has the lines which scrolling on in its current direction and at its
+ * current pace brings into view next read ahead in the background. Steps of
+ * more than a page, as by the thumb or by DoStep() on a higher digit, are
+ * taken to repeat, so what gets read then is the page where the next one
+ * lands. Reversing the direction abandons what is still pending.
+ */
+void MainWindow::Anticipate()
+{
+	int const top = ListView_GetTopIndex(m_hwndList);
+	int const delta = top - m_lasttop;
+	m_lasttop = top;
+	if (delta == 0 || m_prefetchscreens == 0 || m_handle == INVALID_HANDLE_VALUE)
+		return;
+	if (!m_prefetcher.running() && !m_prefetcher.start(m_handle, &m_pagecache))
+		return;
+	ULONGLONG const page = ListView_GetCountPerPage(m_hwndList);
+	ULONGLONG const step = delta > 0 ? delta : -static_cast<LONGLONG>(delta);
+	ULONGLONG const from = top;
+	ULONGLONG first;
+	ULONGLONG count;
+	if (step > page)
+	{
+		first = delta > 0 ? from + step : from > step ? from - step : 0;
+		count = page;
+	}
+	else if (delta > 0)
+	{
+		first = from + page;
+		count = page * m_prefetchscreens;
+	}
+	else
+	{
+		count = page * m_prefetchscreens;
+		first = from > count ? from - count : 0;
+		count = from - first;
+	}
+	// Lines ahead of indexing have no known location yet
+	ULONGLONG const lines = m_index.size();
+	if (count == 0 || first >= lines)
+		return;
+	ULONGLONG const last = first + count < lines ? first + count - 1 : lines - 1;
+	LineData lower, upper;
+	ULONGLONG span;
+	if (!m_index.getSpan(first, lower, span) || !m_index.getSpan(last, upper, span))
+		return;
+	ULONGLONG begin = lower.offset;
+	ULONGLONG end = upper.offset + upper.len;
+	// Don't let reading ahead push out more than half of the cache
+	ULONGLONG const limit = static_cast<ULONGLONG>(m_pagecache.capacity() / 2) * PageCache::PageSize;
+	if (end - begin > limit)
+	{
+		if (delta > 0)
+			end = begin + limit;
+		else
+			begin = end - limit;
+	}
+	m_prefetcher.request(begin, end, delta < 0);
+}
+
+void MainWindow::AdjustScrollRange()
+{
+	RECT rc;
 	GetClientRect(m_hwndList, &rc);
 	SCROLLINFO si;
 	si.cbSize = sizeof si;
@@ -1817,20 +2875,12 @@ void MainWindow::DoHScroll(WORD code)
 	}
 }
 
-LineData *MainWindow::Reserve(WORD w)
-{
-	return m_index[w] = static_cast<LineData *>(CoTaskMemAlloc(0x10000 * sizeof(LineData)));
-}
-
-LineData *MainWindow::GetAt(DWORD dw) const
-{
-	return m_index && m_index[HIWORD(dw)] ? &m_index[HIWORD(dw)][LOWORD(dw)] : NULL;
-}
-
 HANDLE MainWindow::Open(LPCTSTR path)
 {
-	HANDLE h1 = CreateFile(path, FILE_GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
-	HANDLE h2 = CreateFile(path, FILE_GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	// Allow for log rotation to rename or delete the file while it is open
+	DWORD const share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+	HANDLE h1 = CreateFile(path, FILE_GENERIC_READ, share, NULL, OPEN_EXISTING, 0, NULL);
+	HANDLE h2 = CreateFile(path, FILE_GENERIC_READ, share, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
 	if (h1 != h2)
 	{
 		if (h1 == INVALID_HANDLE_VALUE)
@@ -1843,10 +2893,6 @@ HANDLE MainWindow::Open(LPCTSTR path)
 			CloseHandle(h1);
 			h1 = INVALID_HANDLE_VALUE;
 		}
-		else
-		{
-			m_index = static_cast<LineData **>(CoTaskMemAlloc(0x10000 * sizeof(LineData *)));
-		}
 	}
 	m_handle = h1;
 	return h2;
@@ -1859,15 +2905,225 @@ void MainWindow::Close()
 		CloseHandle(m_handle);
 		m_handle = INVALID_HANDLE_VALUE;
 	}
-	if (m_index)
+	m_prefetcher.stop();
+	m_pagecache.clear();
+	m_linecache.clear();
+	m_columnindex.clear();
+	m_fileview.close();
+	m_lasttop = 0;
+	m_index.clear();
+	m_stats.clear();
+	m_peek.clear();
+	m_peekline = 0;
+	m_peekexact = false;
+	for (UINT i = 0; i < _countof(m_rescans); ++i)
+	{
+		CoTaskMemFree(m_rescans[i]);
+		m_rescans[i] = NULL;
+	}
+	if (m_cache != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_cache);
+		m_cache = INVALID_HANDLE_VALUE;
+	}
+	m_cacheblock = 0;
+	m_cachelines = 0;
+	m_cachesize = 0;
+}
+
+/**
+ * @brief Determines the path to the file through which the index of the
+ * current file persists, as configured through the IndexCache setting.
+ */
+bool MainWindow::GetIndexPath(LPTSTR path) const
+{
+	TCHAR buf[MAX_PATH];
+	GetPrivateProfileString(_T("Settings"), _T("IndexCache"), NULL, buf, _countof(buf), IniPath);
+	if (buf[0] == _T('\0'))
+		return false;
+	DWORD const len = ExpandEnvironmentStrings(buf, path, MAX_PATH);
+	if (len == 0 || len > MAX_PATH)
+		return false;
+	CreateDirectory(path, NULL);
+	lstrcpyn(buf, m_path, _countof(buf));
+	CharUpper(buf);
+	ULONGLONG const hash = HashBytes(0xCBF29CE484222325ULL, buf, lstrlen(buf) * sizeof(TCHAR));
+	wsprintf(buf, _T("%08lX%08lX.idx"), static_cast<DWORD>(hash >> 32), static_cast<DWORD>(hash));
+	return PathAppend(path, buf) != FALSE;
+}
+
+/**
+ * @brief Deletes the least recently used of the index files which reside
+ * alongside the one at path, other than that one, until the rest take no more
+ * than limit octets, or one fails to delete, as when in use by another session.
+ */
+static void TrimIndexCache(LPCTSTR path, ULONGLONG limit)
+{
+	LPCTSTR const keep = PathFindFileName(path);
+	TCHAR pattern[MAX_PATH];
+	lstrcpyn(pattern, path, _countof(pattern));
+	LPTSTR const name = PathFindFileName(pattern);
+	for (;;)
 	{
-		DWORD i = LOWORD(m_lines) ? HIWORD(m_lines) + 1 : HIWORD(m_lines);
-		while (i != 0)
-			CoTaskMemFree(m_index[--i]);
-		CoTaskMemFree(m_index);
-		m_index = NULL;
+		lstrcpy(name, _T("*.idx"));
+		WIN32_FIND_DATA fd;
+		HANDLE const find = FindFirstFile(pattern, &fd);
+		if (find == INVALID_HANDLE_VALUE)
+			return;
+		ULONGLONG total = 0;
+		FILETIME oldest = { 0, 0 };
+		TCHAR victim[MAX_PATH] = _T("");
+		do
+		{
+			if (lstrcmpi(fd.cFileName, keep) == 0)
+				continue;
+			ULARGE_INTEGER size;
+			size.LowPart = fd.nFileSizeLow;
+			size.HighPart = fd.nFileSizeHigh;
+			total += size.QuadPart;
+			if (victim[0] == _T('\0') || CompareFileTime(&fd.ftLastWriteTime, &oldest) < 0)
+			{
+				oldest = fd.ftLastWriteTime;
+				lstrcpyn(victim, fd.cFileName, _countof(victim));
+			}
+		} while (FindNextFile(find, &fd));
+		FindClose(find);
+		if (total <= limit || victim[0] == _T('\0'))
+			return;
+		lstrcpyn(name, victim, static_cast<int>(_countof(pattern) - (name - pattern)));
+		if (!DeleteFile(pattern))
+			return;
 	}
-	m_lines = 0;
+}
+
+/**
+ * @brief Reads the index which a previous session has persisted for the
+ * current file back into m_index, provided that it still applies to the file.
+ * Files below the IndexCacheThreshold setting in MiB don't persist their index,
+ * and index files take no more than the IndexCacheLimit setting in MiB.
+ * @return Offset of the last line, which is left to be indexed anew along
+ * with anything appended meanwhile, or 0 if there is nothing to resume from.
+ */
+ULONGLONG MainWindow::LoadIndex(HANDLE handle)
+{
+	TCHAR path[MAX_PATH];
+	LARGE_INTEGER size;
+	ULONGLONG const threshold = static_cast<ULONGLONG>(GetPrivateProfileInt(_T("Settings"), _T("IndexCacheThreshold"), 64, IniPath)) << 20;
+	if (m_index.interval() != 1 || !GetFileSizeEx(handle, &size) ||
+		static_cast<ULONGLONG>(size.QuadPart) < threshold || !GetIndexPath(path))
+	{
+		return 0;
+	}
+	TrimIndexCache(path, static_cast<ULONGLONG>(GetPrivateProfileInt(_T("Settings"), _T("IndexCacheLimit"), 1024, IniPath)) << 20);
+	// Sessions which view the same file go without the index file rather
+	// than share it, as they would overwrite each other's blocks
+	m_cache = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_cache == INVALID_HANDLE_VALUE)
+		return 0;
+	// Have the time of last write reflect last use, by which to trim
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	SetFileTime(m_cache, NULL, NULL, &now);
+	IndexHeader header;
+	DWORD bytes;
+	FILETIME mtime;
+	if (!ReadFile(m_cache, &header, sizeof header, &bytes, NULL) || bytes != sizeof header ||
+		header.magic != IndexMagic || header.mode != MAKEWORD(m_encoding, m_delimiter) ||
+		header.terminator != HashBytes(0xCBF29CE484222325ULL, m_terminator, m_terminatorlength) ||
+		header.lines == 0 || lstrcmpi(header.path, m_path) != 0 ||
+		!GetFileTime(handle, NULL, NULL, &mtime) ||
+		static_cast<ULONGLONG>(size.QuadPart) < header.size ||
+		static_cast<ULONGLONG>(size.QuadPart) == header.size && CompareFileTime(&mtime, &header.mtime) != 0 ||
+		SampleContents(handle, header.size) != header.sample)
+	{
+		return 0;
+	}
+	// Leave out the last line, and have the block it ends up in stay open
+	// to further lines
+	ULONGLONG const lines = header.lines - 1;
+	UINT const blocks = static_cast<UINT>(lines >> 16) + 1;
+	LARGE_INTEGER const zero = { 0, 0 };
+	LARGE_INTEGER pos = zero;
+	for (UINT i = 0; i < blocks; ++i)
+	{
+		UINT const count = i + 1 < blocks ? 0x10000 : LOWORD(lines);
+		if (!SetFilePointerEx(m_cache, zero, &pos, FILE_CURRENT) ||
+			count != 0 && !m_index.read(m_cache, count, i + 1 == blocks))
+		{
+			m_index.clear();
+			return 0;
+		}
+	}
+	m_cacheblock = pos.QuadPart;
+	m_cachelines = header.lines;
+	m_cachesize = header.size;
+	m_stats.resume(header.stats);
+	return m_index.getExtent(0);
+}
+
+/**
+ * @brief Writes those blocks of m_index which have changed since LoadIndex()
+ * to the file through which the index persists, followed by the header.
+ */
+void MainWindow::SaveIndex(HANDLE handle)
+{
+	ULONGLONG const lines = m_index.size();
+	if (m_cache == INVALID_HANDLE_VALUE || lines == 0)
+		return;
+	ULONGLONG const end = m_index.getExtent(0);
+	if (lines == m_cachelines && end == m_cachesize)
+		return;
+	IndexHeader header;
+	ZeroMemory(&header, sizeof header);
+	header.magic = IndexMagic;
+	header.mode = MAKEWORD(m_encoding, m_delimiter);
+	header.terminator = HashBytes(0xCBF29CE484222325ULL, m_terminator, m_terminatorlength);
+	header.lines = lines;
+	header.size = end;
+	header.sample = SampleContents(handle, header.size);
+	GetFileTime(handle, NULL, NULL, &header.mtime);
+	lstrcpyn(header.path, m_path, _countof(header.path));
+	m_stats.settle(header.stats);
+	// Blocks vary in size, so start over from where the block which was last
+	// when the index got loaded or saved resides
+	LARGE_INTEGER pos;
+	pos.QuadPart = m_cachelines ? m_cacheblock : sizeof header;
+	UINT const blocks = static_cast<UINT>(lines - 1 >> 16) + 1;
+	UINT i = m_cachelines ? static_cast<UINT>(m_cachelines - 1 >> 16) : 0;
+	if (!SetFilePointerEx(m_cache, pos, NULL, FILE_BEGIN))
+		return;
+	while (i < blocks && !m_stop)
+	{
+		LARGE_INTEGER const zero = { 0, 0 };
+		if (!SetFilePointerEx(m_cache, zero, &pos, FILE_CURRENT) || !m_index.write(m_cache, i))
+			break;
+		++i;
+	}
+	// Write the header only once the blocks it refers to are in place
+	if (i == blocks && SetEndOfFile(m_cache))
+	{
+		LARGE_INTEGER const zero = { 0, 0 };
+		DWORD bytes;
+		if (SetFilePointerEx(m_cache, zero, NULL, FILE_BEGIN) &&
+			WriteFile(m_cache, &header, sizeof header, &bytes, NULL))
+		{
+			m_cacheblock = pos.QuadPart;
+			m_cachelines = header.lines;
+			m_cachesize = header.size;
+		}
+	}
+}
+
+/**
+ * @brief Determines how many buffers a LineReader which reads ahead is to use,
+ * which is one more than the number of reads to keep in flight. The default of
+ * 3 reads gets most of what overlapping has to offer on media which take long
+ * to respond, with little to gain beyond. See tests/reader.cpp.
+ */
+static UINT ReadAheadDepth()
+{
+	UINT const depth = GetPrivateProfileInt(_T("Settings"), _T("ReadAheadDepth"), 3, IniPath);
+	return (depth < 1 ? 1 : depth < 16 ? depth : 16) + 1;
 }
 
 DWORD MainWindow::ReadThread()
@@ -1875,11 +3131,11 @@ DWORD MainWindow::ReadThread()
 	HANDLE handle = Open(m_path);
 	if (handle != INVALID_HANDLE_VALUE)
 	{
-		LineReader reader = handle;
-		UINT const limit = MAX_BIT_FIELD_UNSIGNED(LineData, len);
-		DWORD const then = GetTickCount();
-		DWORD ticks = then;
-		LineData *lineindex = NULL;
+		LineReader reader(handle);
+		if (GetPrivateProfileInt(_T("Settings"), _T("MappedIndexing"), 0, IniPath))
+			reader.mapViews();
+		else if (UINT size = GetPrivateProfileInt(_T("Settings"), _T("ReadAhead"), 0, IniPath))
+			reader.readAhead((size < 16 ? size : 16) << 20, ReadAheadDepth());
 		ULARGE_INTEGER pos = { 0, 0 };
 		if (m_encoding == LineReader::NONE)
 		{
@@ -2026,54 +3282,76 @@ DWORD MainWindow::ReadThread()
 				}
 			}
 		}
-		wchar_t eol = m_delimiter;
-		switch (m_encoding)
+		m_index.setInterval(GetPrivateProfileInt(_T("Settings"), _T("SparseIndexing"), 0, IniPath));
+		// Pick up from where the index which a previous session has left
+		// behind ends, or else from just past the BOM
+		if (ULONGLONG const resume = LoadIndex(handle))
+			pos.QuadPart = resume;
+		ApplyTerminator(reader);
+		reader.seek(pos.QuadPart);
+		// Split what is left to index into ranges to index in parallel,
+		// provided that each range gets to span at least a stride
+		ULONGLONG const stride = 0x4000000;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(handle, &size) || static_cast<ULONGLONG>(size.QuadPart) < pos.QuadPart)
+			size.QuadPart = pos.QuadPart;
+		ULONGLONG const ahead = size.QuadPart - pos.QuadPart;
+		UINT count = GetPrivateProfileInt(_T("Settings"), _T("IndexingThreads"), 0, IniPath);
+		if (count == 0)
 		{
-		case LineReader::UCS2BE:
-			eol <<= 8;
-			// fall through
-		case LineReader::UCS2LE:
-			while (size_t len = reader.readLineWide(limit, eol))
+			SYSTEM_INFO si;
+			GetSystemInfo(&si);
+			count = si.dwNumberOfProcessors;
+		}
+		if (count > MAXIMUM_WAIT_OBJECTS)
+			count = MAXIMUM_WAIT_OBJECTS;
+		if (count > ahead / stride)
+			count = static_cast<UINT>(ahead / stride);
+		// Spans of a sparse index must start on multiples of its interval,
+		// which rules out stitching together ranges indexed in parallel, and
+		// so do longer record terminators, as where a run of them splits into
+		// records depends on where reading starts
+		if (m_index.interval() != 1 || m_terminatorlength > 1)
+			count = 1;
+		// Have the ranges beyond the first one live on the heap rather than
+		// on the stack, which already holds the reader
+		Range *const ranges = count > 1 ? new(std::nothrow) Range[count - 1] : NULL;
+		if (ranges == NULL)
+			count = 1;
+		ULONGLONG end = ~0ULL;
+		for (UINT i = count; i > 1; )
+		{
+			Range &range = ranges[--i - 1];
+			// Have boundaries reside on allocation granularity, which implies
+			// that they also respect alignment of UCS2 code units
+			ULONGLONG const begin = pos.QuadPart + ahead / count * i & ~0xFFFFULL;
+			// Start one code unit early so as to notice a delimiter right
+			// before begin, at which point the preceding range leaves off
+			range.owner = this;
+			range.begin = begin - (m_encoding == LineReader::UCS2LE || m_encoding == LineReader::UCS2BE ? 2 : 1);
+			range.end = end;
+			range.thread = CreateThread(NULL, 0, StartIndexRange, &range, 0, NULL);
+			end = begin;
+		}
+		IndexLines(reader, pos.QuadPart, end, m_index, m_stats, START_LINE);
+		for (UINT i = 1; i < count; ++i)
+		{
+			Range &range = ranges[i - 1];
+			if (range.thread)
 			{
-				if (LOWORD(m_lines) == 0)
-				{
-					lineindex = Reserve(HIWORD(m_lines));
-					if (lineindex == NULL)
-						break;
-				}
-				LineData &linedata = lineindex[LOWORD(m_lines)];
-				linedata.LowPart = pos.LowPart;
-				linedata.HighPart = pos.HighPart;
-				linedata.flags = 0;
-				linedata.len = len;
-				pos.QuadPart += len;
-				++m_lines;
-				if (m_stop)
-					break;
+				WaitForSingleObject(range.thread, INFINITE);
+				CloseHandle(range.thread);
 			}
-			break;
-		default:
-			// assume octet encoding
-			while (size_t len = reader.readLineAnsi(limit, static_cast<char>(eol)))
+			else
 			{
-				if (LOWORD(m_lines) == 0)
-				{
-					lineindex = Reserve(HIWORD(m_lines));
-					if (lineindex == NULL)
-						break;
-				}
-				LineData &linedata = lineindex[LOWORD(m_lines)];
-				linedata.LowPart = pos.LowPart;
-				linedata.HighPart = pos.HighPart;
-				linedata.flags = 0;
-				linedata.len = len;
-				pos.QuadPart += len;
-				++m_lines;
-				if (m_stop)
-					break;
+				IndexRange(&range);
 			}
-			break;
+			AppendRange(range);
 		}
+		delete[] ranges;
+		m_indexed = m_index.getExtent(pos.QuadPart);
+		if (!m_stop)
+			SaveIndex(handle);
 		CloseHandle(handle);
 	}
 	PostMessage(m_hwnd, WM_TIMER, ~ReadThreadFinishedTimer, 0);
@@ -2085,6 +3363,358 @@ DWORD MainWindow::StartReadThread(LPVOID pv)
 	return static_cast<MainWindow *>(pv)->ReadThread();
 }
 
+/**
+ * @brief Indexes what has been appended to the file since it was last indexed.
+ */
+DWORD MainWindow::TailThread()
+{
+	HANDLE handle = CreateFile(m_path, FILE_GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle != INVALID_HANDLE_VALUE)
+	{
+		// Find out whether the last line is complete, or is to be continued
+		Start start = START_LINE;
+		if (m_index.size() != 0)
+		{
+			BYTE terminator[LineReader::MaxDelimiter];
+			DWORD const size = EncodeTerminator(terminator);
+			BYTE tail[LineReader::MaxDelimiter];
+			if (m_indexed < size || FileAccess::read(handle, m_indexed - size, tail, size) != size ||
+				memcmp(tail, terminator, size) != 0)
+			{
+				start = CONTINUE_LINE;
+			}
+		}
+		LineReader reader(handle);
+		ApplyTerminator(reader);
+		if (reader.seek(m_indexed))
+		{
+			if (GetPrivateProfileInt(_T("Settings"), _T("MappedIndexing"), 0, IniPath))
+				reader.mapViews();
+			else if (UINT size = GetPrivateProfileInt(_T("Settings"), _T("ReadAhead"), 0, IniPath))
+				reader.readAhead((size < 16 ? size : 16) << 20, ReadAheadDepth());
+			IndexLines(reader, m_indexed, ~0ULL, m_index, m_stats, start);
+			m_indexed = m_index.getExtent(m_indexed);
+			if (!m_stop)
+				SaveIndex(handle);
+		}
+		CloseHandle(handle);
+	}
+	PostMessage(m_hwnd, WM_TIMER, ~ReadThreadFinishedTimer, 0);
+	return 0;
+}
+
+DWORD MainWindow::StartTailThread(LPVOID pv)
+{
+	return static_cast<MainWindow *>(pv)->TailThread();
+}
+
+/**
+ * @brief Starts to watch the current file if follow mode is on.
+ */
+void MainWindow::Watch()
+{
+	if (m_watcher == NULL && m_path[0] != _T('\0') &&
+		(GetMenuState(m_menu, IDM_FOLLOW, MF_BYCOMMAND) & MF_CHECKED))
+	{
+		m_unwatch = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (m_unwatch)
+			m_watcher = CreateThread(NULL, 0, StartWatchThread, this, 0, NULL);
+	}
+}
+
+void MainWindow::Unwatch()
+{
+	if (m_watcher)
+	{
+		SetEvent(m_unwatch);
+		WaitForSingleObject(m_watcher, INFINITE);
+		CloseHandle(m_watcher);
+		m_watcher = NULL;
+	}
+	if (m_unwatch)
+	{
+		CloseHandle(m_unwatch);
+		m_unwatch = NULL;
+	}
+}
+
+DWORD MainWindow::WatchThread()
+{
+	TCHAR path[MAX_PATH];
+	lstrcpyn(path, m_path, _countof(path));
+	PathRemoveFileSpec(path);
+	HANDLE const handles[] =
+	{
+		m_unwatch,
+		FindFirstChangeNotification(path, FALSE,
+			FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE)
+	};
+	DWORD const count = handles[1] != INVALID_HANDLE_VALUE ? 2 : 1;
+	// The size of a file which is held open for writing may change without
+	// notice until the writer closes it, so poll at regular intervals as well
+	for (;;)
+	{
+		DWORD const wait = WaitForMultipleObjects(count, handles, FALSE, 1000);
+		if (wait == WAIT_OBJECT_0 + 1)
+			FindNextChangeNotification(handles[1]);
+		else if (wait != WAIT_TIMEOUT)
+			break;
+		PostMessage(m_hwnd, WM_TIMER, FileChangedTimer, 0);
+	}
+	if (count == 2)
+		FindCloseChangeNotification(handles[1]);
+	return 0;
+}
+
+DWORD MainWindow::StartWatchThread(LPVOID pv)
+{
+	return static_cast<MainWindow *>(pv)->WatchThread();
+}
+
+/**
+ * @brief Catches up with changes to the file in follow mode. Starts over if
+ * the file has been truncated, or replaced as in the course of log rotation.
+ */
+void MainWindow::Follow()
+{
+	if (m_thread != NULL || m_handle == INVALID_HANDLE_VALUE)
+		return;
+	HANDLE const handle = CreateFile(m_path, FILE_GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		return; // possibly amid rotation, so try again later
+	BY_HANDLE_FILE_INFORMATION current, previous;
+	bool const replaced =
+		!GetFileInformationByHandle(handle, &current) ||
+		!GetFileInformationByHandle(m_handle, &previous) ||
+		current.dwVolumeSerialNumber != previous.dwVolumeSerialNumber ||
+		current.nFileIndexHigh != previous.nFileIndexHigh ||
+		current.nFileIndexLow != previous.nFileIndexLow;
+	CloseHandle(handle);
+	ULARGE_INTEGER size;
+	size.LowPart = current.nFileSizeLow;
+	size.HighPart = current.nFileSizeHigh;
+	// Indexing holds back an octet which ends the file amid a UCS-2 code
+	// unit, so there is nothing to catch up with until the rest arrives
+	ULONGLONG const complete = m_encoding == LineReader::UCS2LE || m_encoding == LineReader::UCS2BE ?
+		size.QuadPart & ~1ULL : size.QuadPart;
+	if (replaced || size.QuadPart < m_indexed)
+		Refresh();
+	else if (complete > m_indexed)
+		StartThread(StartTailThread);
+}
+
+DWORD MainWindow::IndexRange(Range *range)
+{
+	HANDLE handle = CreateFile(m_path, FILE_GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle != INVALID_HANDLE_VALUE)
+	{
+		LineReader reader(handle);
+		ApplyTerminator(reader);
+		if (reader.seek(range->begin))
+		{
+			if (GetPrivateProfileInt(_T("Settings"), _T("MappedIndexing"), 0, IniPath))
+				reader.mapViews();
+			else if (UINT size = GetPrivateProfileInt(_T("Settings"), _T("ReadAhead"), 0, IniPath))
+				reader.readAhead((size < 16 ? size : 16) << 20, ReadAheadDepth());
+			IndexLines(reader, range->begin, range->end, range->index, range->stats, SKIP_LINE);
+		}
+		CloseHandle(handle);
+	}
+	return 0;
+}
+
+DWORD MainWindow::StartIndexRange(LPVOID pv)
+{
+	Range *const range = static_cast<Range *>(pv);
+	return range->owner->IndexRange(range);
+}
+
+/**
+ * @brief Encodes the record terminator as it occurs in the file.
+ * @param [out] encoded Receives up to LineReader::MaxDelimiter octets.
+ * @return Number of octets.
+ */
+UINT MainWindow::EncodeTerminator(BYTE *encoded) const
+{
+	UINT length = 0;
+	for (UINT i = 0; i < m_terminatorlength; ++i)
+	{
+		if (m_encoding == LineReader::UCS2BE)
+			encoded[length++] = 0;
+		encoded[length++] = static_cast<BYTE>(m_terminator[i]);
+		if (m_encoding == LineReader::UCS2LE)
+			encoded[length++] = 0;
+	}
+	return length;
+}
+
+/**
+ * @brief Has reader split records on the record terminator if it is longer
+ * than the delimiter alone.
+ */
+void MainWindow::ApplyTerminator(LineReader &reader) const
+{
+	if (m_terminatorlength > 1)
+	{
+		BYTE encoded[LineReader::MaxDelimiter];
+		reader.setDelimiter(encoded, EncodeTerminator(encoded));
+	}
+}
+
+/**
+ * @brief Checks whether an 8-bit text ends with the record terminator.
+ */
+bool MainWindow::EndsWithTerminator(char const *text, size_t len) const
+{
+	return len >= m_terminatorlength &&
+		memcmp(text + len - m_terminatorlength, m_terminator, m_terminatorlength) == 0;
+}
+
+/**
+ * @brief Determines the delimiter as a code unit of the current encoding.
+ * @return Whether code units are two octets wide.
+ */
+bool MainWindow::GetDelimiter(wchar_t &eol) const
+{
+	eol = m_delimiter;
+	switch (m_encoding)
+	{
+	case LineReader::UCS2BE:
+		eol <<= 8;
+		// fall through
+	case LineReader::UCS2LE:
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Indexes the lines which start within [pos, end), along with any
+ * continuation of the last one beyond end. With SKIP_LINE, pos is assumed to
+ * lie within a line which belongs to the preceding range, so indexing starts
+ * past the first delimiter found. With CONTINUE_LINE, the octets up to the
+ * first delimiter found extend the last line in index. Statistics go to stats
+ * for all but the skipped octets.
+ */
+void MainWindow::IndexLines(LineReader &reader, ULONGLONG pos, ULONGLONG end, LineIndex &index, LineStats &stats, Start start)
+{
+	UINT const limit = LineIndex::LengthLimit;
+	wchar_t eol;
+	bool const wide = GetDelimiter(eol);
+	reader.setEnd(end);
+	bool skip = start == SKIP_LINE;
+	while (skip)
+	{
+		size_t const n = wide ?
+			reader.readLineWide(limit, eol) :
+			reader.readLineAnsi(limit, static_cast<char>(eol));
+		if (n == 0 || m_stop)
+			return;
+		pos += n;
+		skip = !reader.lastLineDelimited();
+	}
+	stats.setEncoding(m_encoding);
+	reader.tally(&stats);
+	if (start == CONTINUE_LINE)
+		ContinueLine(reader, pos, index);
+	bool delimited = true;
+	// Have the reader fill in the lengths of an entire block at a time
+	if (UINT *const lengths = static_cast<UINT *>(CoTaskMemAlloc(0x10000 * sizeof(UINT))))
+	{
+		while (!m_stop)
+		{
+			size_t const count = 0x10000;
+			size_t const n = wide ?
+				reader.readLinesWide(lengths, count, limit, eol) :
+				reader.readLinesAnsi(lengths, count, limit, static_cast<char>(eol));
+			if (n == 0)
+				break;
+			UINT const appended = index.append(pos, lengths, static_cast<UINT>(n));
+			if (&index != &m_index)
+				InterlockedExchangeAdd64(&m_pending, appended);
+			if (appended < n)
+			{
+				delimited = true; // give up on the remaining lines
+				break;
+			}
+			for (size_t i = 0; i < n; ++i)
+				pos += lengths[i];
+			delimited = reader.lastLineDelimited();
+			if (n < count)
+				break;
+		}
+		CoTaskMemFree(lengths);
+	}
+	// Follow the last line across end, until reaching where the next range
+	// picks up, while applying the same length limit as if read in one go
+	reader.setEnd();
+	if (!delimited && !m_stop)
+		ContinueLine(reader, pos, index);
+}
+
+/**
+ * @brief Extends the last line in index up to the next delimiter, starting
+ * over with a new line whenever the length limit is reached.
+ */
+void MainWindow::ContinueLine(LineReader &reader, ULONGLONG &pos, LineIndex &index)
+{
+	UINT const limit = LineIndex::LengthLimit;
+	wchar_t eol;
+	bool const wide = GetDelimiter(eol);
+	while (index.size() != 0)
+	{
+		UINT const room = limit - index.lastLength();
+		size_t const n = wide ?
+			reader.readLineWide(room ? room : limit, eol) :
+			reader.readLineAnsi(room ? room : limit, static_cast<char>(eol));
+		if (n == 0)
+			break;
+		UINT const len = static_cast<UINT>(n);
+		if (room != 0)
+		{
+			index.extend(len);
+		}
+		else if (index.append(pos, &len, 1) == 0)
+		{
+			break;
+		}
+		else if (&index != &m_index)
+		{
+			InterlockedIncrement64(&m_pending);
+		}
+		pos += n;
+		if (reader.lastLineDelimited() || m_stop)
+			break;
+	}
+}
+
+/**
+ * @brief Moves the lines of a range which has been indexed in parallel over
+ * to m_index, unless indexing has been stopped and thus left a gap.
+ */
+void MainWindow::AppendRange(Range &range)
+{
+	ULONGLONG const lines = range.index.size();
+	ULONGLONG i = 0;
+	if (UINT *const lengths = static_cast<UINT *>(CoTaskMemAlloc(0x10000 * sizeof(UINT))))
+	{
+		LineData linedata;
+		while (i < lines && !m_stop && range.index.getAt(i, linedata))
+		{
+			UINT const n = range.index.getLengths(i, lengths, 0x10000);
+			UINT const appended = m_index.append(linedata.offset, lengths, n);
+			InterlockedExchangeAdd64(&m_pending, -static_cast<LONGLONG>(appended));
+			i += appended;
+			if (appended < n)
+				break;
+		}
+		CoTaskMemFree(lengths);
+	}
+	InterlockedExchangeAdd64(&m_pending, -static_cast<LONGLONG>(lines - i));
+	range.index.clear();
+	m_stats.merge(range.stats);
+}
+
 void MainWindow::Open(LPCTSTR path, WORD mode)
 {
 	if (m_thread != NULL)
@@ -2092,7 +3722,6 @@ void MainWindow::Open(LPCTSTR path, WORD mode)
 	ListView_SetItemCount(m_hwndList, 0);
 	ListView_SetColumnWidth(m_hwndList, 1, LVSCW_AUTOSIZE_USEHEADER);
 	Close();
-	m_lines = 0;
 	m_width = 0;
 	m_offset = 0;
 	if (m_encoding != static_cast<LineReader::Encoding>(LOBYTE(mode)))
@@ -2100,10 +3729,18 @@ void MainWindow::Open(LPCTSTR path, WORD mode)
 		m_encoding = static_cast<LineReader::Encoding>(LOBYTE(mode));
 		m_encodinginfo = NULL;
 	}
-	if (m_delimiter != static_cast<char>(HIBYTE(mode)))
+	// Keep a longer record terminator only if it still ends in the delimiter
+	char const delimiter = static_cast<char>(HIBYTE(mode));
+	bool const reset = m_terminatorlength == 0 || m_terminator[m_terminatorlength - 1] != delimiter;
+	if (reset)
 	{
-		m_delimiter = static_cast<char>(HIBYTE(mode));
-		if (m_delimiter != '\n')
+		m_terminator[0] = delimiter;
+		m_terminatorlength = 1;
+	}
+	if (m_delimiter != delimiter || reset)
+	{
+		m_delimiter = delimiter;
+		if (m_delimiter != '\n' || m_terminatorlength > 1)
 		{
 			EnableMenuItem(m_menu, IDM_USE_AGREP, MF_DISABLED | MF_GRAYED);
 			CheckMenuItem(m_menu, IDM_USE_AGREP, MF_CHECKED);
@@ -2120,11 +3757,21 @@ void MainWindow::Open(LPCTSTR path, WORD mode)
 	AdjustScrollRange();
 	SetFocus(m_hwndLine);
 	if (m_path != path)
+	{
+		Unwatch();
 		PathCanonicalize(m_path, path);
+		Watch();
+	}
 	UpdateWindowTitle();
+	m_indexed = 0;
+	StartThread(StartReadThread);
+}
+
+void MainWindow::StartThread(LPTHREAD_START_ROUTINE proc)
+{
 	m_stop = false;
 	m_then = GetTickCount();
-	m_thread = CreateThread(NULL, 0, StartReadThread, this, 0, NULL);
+	m_thread = CreateThread(NULL, 0, proc, this, 0, NULL);
 	if (m_thread != NULL)
 	{
 		SetTimer(m_hwnd, ReadThreadFinishedTimer, 500, NULL);
@@ -2145,22 +3792,72 @@ void MainWindow::SelectLine(int i)
 	}
 }
 
+/**
+ * @brief Writes a record terminator as a regular expression for the -d option
+ * of AGREP. Control characters other than CR, LF, or TAB take the form \xNN.
+ * @return Pointer to the terminating zero, or NULL if not expressible, which
+ * is the case if the terminator includes a zero.
+ */
+static LPTSTR EscapeTerminator(LPTSTR p, char const *terminator, UINT length)
+{
+	for (UINT i = 0; i < length; ++i)
+	{
+		TCHAR c = static_cast<BYTE>(terminator[i]);
+		switch (c)
+		{
+		case _T('\r'):
+			*p++ = _T('\\');
+			c = _T('r');
+			break;
+		case _T('\n'):
+			*p++ = _T('\\');
+			c = _T('n');
+			break;
+		case _T('\t'):
+			*p++ = _T('\\');
+			c = _T('t');
+			break;
+		case _T('\0'):
+			return NULL;
+		default:
+			if (c < _T(' '))
+			{
+				p += wsprintf(p, _T("\\x%02X"), c);
+				continue;
+			}
+			if (_tcschr(_T(".[]()*+?{}|^$\\"), c))
+				*p++ = _T('\\');
+			break;
+		}
+		*p++ = c;
+	}
+	*p = _T('\0');
+	return p;
+}
+
 void MainWindow::DoSearch(int direction)
 {
 	if (int n = ListView_GetItemCount(m_hwndList))
 	{
 		if (SendMessage(m_hwndText, EM_GETMODIFY, 0, 0))
 		{
-			for (int i = 0; i < n; ++i)
-			{
-				m_index[HIWORD(i)][LOWORD(i)].flags &= ~1;
-			}
+			m_index.clearMatches();
 			if (BSTR text = GetWindowText(m_hwndText))
 			{
 				UINT const use_agrep = GetMenuState(m_menu, IDM_USE_AGREP, MF_BYCOMMAND) & MF_CHECKED;
 				UINT const no_regexp = GetMenuState(m_menu, IDM_LITERAL, MF_BYCOMMAND) & MF_CHECKED;
 				UINT const ignore_case = GetMenuState(m_menu, IDM_IGNORE_CASE, MF_BYCOMMAND) & MF_CHECKED;
 				UINT const invert = GetMenuState(m_menu, IDM_INVERT, MF_BYCOMMAND) & MF_CHECKED;
+				// Searching without the terminator would match across records,
+				// and report line numbers which don't correspond to the view
+				TCHAR regex[4 * _countof(m_terminator) + 1];
+				if (use_agrep && m_terminatorlength > 1 &&
+					EscapeTerminator(regex, m_terminator, m_terminatorlength) == NULL)
+				{
+					MessageBox(m_hwnd, _T("AGREP cannot search records whose terminator includes a zero."), NULL, MB_ICONWARNING);
+					SysFreeString(text);
+					return;
+				}
 				// Apply convenience shortcuts for FINDSTR only when not using AGREP
 				if (!use_agrep && !no_regexp)
 				{
@@ -2177,8 +3874,9 @@ void MainWindow::DoSearch(int direction)
 				//   261 chars quoted path to exe
 				// + 261 chars quoted path to input file plus
 				// +  58 chars noise and spaces
+				// +  72 chars all-escaped record terminator
 				// +  2n chars all-escaped text
-				if (BSTR const cmd = SysAllocStringLen(NULL, 261 + 261 + 58 + SysStringByteLen(text)))
+				if (BSTR const cmd = SysAllocStringLen(NULL, 261 + 261 + 58 + 72 + SysStringByteLen(text)))
 				{
 					Transcoder transcoder(m_codepage);
 					HANDLE hReadPipe = m_codepage == 1200 || m_codepage == 1201 ? transcoder.Open(m_path) : NULL;
@@ -2203,8 +3901,16 @@ void MainWindow::DoSearch(int direction)
 							*args++ = 'i';
 						if (invert)
 							*args++ = 'v';
-						if (m_delimiter >= '!')
+						if (m_terminatorlength > 1)
+						{
+							args += wsprintf(args, _T("M -d \""));
+							args = EscapeArgument(args, regex);
+							args += wsprintf(args, _T("\""));
+						}
+						else if (m_delimiter >= '!')
+						{
 							args += wsprintf(args, _T("Md%c"), m_delimiter);
+						}
 					}
 					else
 					{
@@ -2235,14 +3941,17 @@ void MainWindow::DoSearch(int direction)
 					{
 						HCURSOR hCursor = SetCursor(LoadCursor(NULL, IDC_WAIT));
 						char buffer[16];
-						LineReader reader = hReadPipe;
+						LineReader reader(hReadPipe);
+						if (m_terminatorlength > 1)
+							reader.setDelimiter(m_terminator, m_terminatorlength);
 						while (size_t len = reader.readLineAnsi(buffer, _countof(buffer) - 1, m_delimiter))
 						{
 							buffer[len] = '\0';
-							int i = atoi(buffer) - 1;
-							if (i >= 0 && i < n)
+							// Line numbers may exceed what an int holds
+							ULONGLONG const i = _strtoui64(buffer, NULL, 10) - 1;
+							if (i < static_cast<ULONGLONG>(n) || i < m_index.size())
 							{
-								m_index[HIWORD(i)][LOWORD(i)].flags |= 0x01;
+								m_index.setMatch(i);
 							}
 							else
 							{
@@ -2253,7 +3962,7 @@ void MainWindow::DoSearch(int direction)
 								MessageBox(m_hwnd, text, NULL, MB_ICONWARNING);
 								break;
 							}
-							if (buffer[len - 1] != m_delimiter)
+							if (!EndsWithTerminator(buffer, len))
 								reader.readLineAnsi(SIZE_MAX, m_delimiter);
 						}
 						CloseHandle(hReadPipe);
@@ -2283,8 +3992,8 @@ void MainWindow::DoSearch(int direction)
 				i = 0;
 			else if (i < 0)
 				i = n - 1;
-		} while ((m_index[HIWORD(i)][LOWORD(i)].flags & 1) == 0 && i != j);
-		if ((m_index[HIWORD(i)][LOWORD(i)].flags & 1) == 0)
+		} while (!m_index.isMatch(i) && i != j);
+		if (!m_index.isMatch(i))
 		{
 			ListView_SetItemState(m_hwndList, -1, 0, LVIS_FOCUSED | LVIS_SELECTED);
 		}
@@ -36,3 +36,4 @@
 #define IDM_OPEN_XML                            40020
 #define IDM_SELECT_FONT                         40021
 #define IDM_USE_DEFAULT_FONT                    40022
+#define IDM_FOLLOW                              40023
@@ -0,0 +1,332 @@
+/*
+ * Checks the decoders against the system's converter, and measures how they
+ * compare with it. Run with "bench" to measure. Tables come from the converter
+ * as well, just as the viewer has the system fill them in. On Windows, the
+ * converter is MultiByteToWideChar(), elsewhere iconv() stands in for it. Where
+ * character-sets.bat has left character-sets-tables.h, the single-byte decoder
+ * also gets checked against what MultiByteToWideChar() has made of each code
+ * page. Builds with "make" or, on Windows, with "cl /O2 /EHsc decoder.cpp".
+ */
+#include "../Decoder.cpp"
+#ifndef _WIN32
+#include <iconv.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+static unsigned Seed = 1;
+
+static unsigned Random()
+{
+	Seed = Seed * 1103515245 + 12345;
+	return Seed >> 8;
+}
+
+// A charset by its name for iconv(), and by its Windows code page
+struct Charset
+{
+	char const *name;
+	unsigned cp;
+};
+
+static Charset const UTF8 = { "UTF-8", 65001 };
+
+static Charset const Charsets[] =
+{
+	{ "CP437", 437 }, { "CP850", 850 }, { "CP1250", 1250 }, { "CP1251", 1251 }, { "CP1252", 1252 },
+	{ "KOI8-R", 20866 }, { "ISO-8859-5", 28595 }, { "ISO-8859-7", 28597 }, { "MACINTOSH", 10000 }, { "IBM037", 37 }
+};
+
+/**
+ * @brief The system's converter from a charset to UTF-16LE.
+ */
+class Converter
+{
+public:
+	explicit Converter(Charset const &charset)
+#ifdef _WIN32
+		: m_cp(charset.cp)
+		, m_ok(IsValidCodePage(charset.cp) != FALSE)
+	{
+	}
+#else
+		: m_cd(iconv_open("UTF-16LE", charset.name))
+		, m_ok(m_cd != reinterpret_cast<iconv_t>(-1))
+	{
+	}
+	~Converter()
+	{
+		if (m_ok)
+			iconv_close(m_cd);
+	}
+#endif
+	bool ok() const { return m_ok; }
+	size_t convert(unsigned char const *p, size_t n, std::vector<unsigned short> &q);
+private:
+#ifdef _WIN32
+	UINT const m_cp;
+#else
+	iconv_t const m_cd;
+#endif
+	bool const m_ok;
+	Converter(Converter const &);
+	Converter &operator=(Converter const &);
+};
+
+/**
+ * @brief Converts octets to UTF-16LE for as long as they are valid. Unlike
+ * iconv(), MultiByteToWideChar() tells only whether all of them are, or else
+ * maps the invalid ones to something, with the same flags as the viewer uses.
+ * @return Number of octets converted.
+ */
+size_t Converter::convert(unsigned char const *p, size_t n, std::vector<unsigned short> &q)
+{
+	q.resize(n + 1);
+#ifdef _WIN32
+	DWORD const flags = m_cp == 65001 ? MB_ERR_INVALID_CHARS : MB_USEGLYPHCHARS;
+	int const count = n != 0 ? MultiByteToWideChar(m_cp, flags, reinterpret_cast<LPCSTR>(p), static_cast<int>(n),
+		reinterpret_cast<LPWSTR>(&q[0]), static_cast<int>(q.size())) : 0;
+	q.resize(count);
+	return count != 0 ? n : 0;
+#else
+	char *in = reinterpret_cast<char *>(const_cast<unsigned char *>(p));
+	size_t inleft = n;
+	char *out = reinterpret_cast<char *>(&q[0]);
+	size_t outleft = q.size() * sizeof q[0];
+	iconv(m_cd, NULL, NULL, NULL, NULL);
+	iconv(m_cd, &in, &inleft, &out, &outleft);
+	q.resize(q.size() - outleft / sizeof q[0]);
+	return n - inleft;
+#endif
+}
+
+/**
+ * @brief Has the converter fill in a table, marking octets it rejects with
+ * U+FFFD.
+ */
+static bool Load(Charset const &charset, DecodeTable &table)
+{
+	Converter converter(charset);
+	if (!converter.ok())
+		return false;
+	std::vector<unsigned short> q;
+	for (unsigned i = 0; i < 0x100; ++i)
+	{
+		unsigned char const c = static_cast<unsigned char>(i);
+		table.units[i] = converter.convert(&c, 1, q) == 1 && q.size() == 1 ? q[0] : 0xFFFD;
+	}
+	table.init();
+	return true;
+}
+
+#ifdef CHARACTER_SETS_TABLES
+// What MultiByteToWideChar() has made of the single-byte code pages which
+// character-sets.dll refers to, as dumped by character-sets-tables.c
+struct SystemTable
+{
+	unsigned cp;
+	unsigned short units[0x100];
+};
+
+static SystemTable const SystemTables[] =
+{
+#define $(CP, ...) { CP, { __VA_ARGS__ } },
+#include "../character-sets-tables.h"
+#undef $
+};
+#endif
+
+static bool Fail(char const *what, unsigned round)
+{
+	printf("%s: mismatch in round %u\n", what, round);
+	return false;
+}
+
+static bool CheckUTF8()
+{
+	static char const *const pieces[] =
+	{
+		"a", "plain ASCII text which spans a block or two ", "\xC3\xA4", "\xE2\x82\xAC", "\xF0\x9F\x98\x80",
+		"\xEF\xBB\xBF", "\xC2\x80", "\xDF\xBF", "\xEF\xBF\xBF", "\xF4\x8F\xBF\xBF", "\xEE\x80\x80", "\n",
+		// What follows is not well-formed
+		"\xED\xA0\x80", "\xC0\xAF", "\xE0\x80\xAF", "\xF4\x90\x80\x80", "\xF5", "\xFF", "\x80", "\xE2\x82", "\xF0\x9F\x98"
+	};
+	size_t const wellformed = 12;
+#ifdef _WIN32
+	// MultiByteToWideChar() doesn't tell how far the octets are well-formed
+	unsigned const illformed = 0;
+#else
+	unsigned const illformed = 3;
+#endif
+	Converter converter(UTF8);
+	if (!converter.ok())
+		return Fail("Converter", 0);
+	DecodeUTF8Proc const decode[] = { DecodeUTF8, DecodeUTF8Generic, DecodeUTF8SSE2 };
+	std::vector<unsigned char> octets;
+	std::vector<unsigned short> expected;
+	std::vector<unsigned short> units;
+	for (unsigned round = 0; round < 100000; ++round)
+	{
+		octets.clear();
+		for (unsigned k = Random() % 60; k != 0; --k)
+		{
+			size_t const i = Random() % 100 >= illformed ? Random() % wellformed : Random() % (sizeof pieces / sizeof *pieces);
+			octets.insert(octets.end(), pieces[i], pieces[i] + strlen(pieces[i]));
+		}
+		size_t const n = octets.size();
+		octets.push_back(0); // keeps &octets[0] valid if n is 0
+		size_t const valid = converter.convert(&octets[0], n, expected);
+		units.resize(n + 1);
+		for (size_t v = 0; v < 3; ++v)
+		{
+			size_t written = 0;
+			if (decode[v](&octets[0], n, &units[0], &written) != valid || written != expected.size() ||
+				memcmp(&units[0], &expected[0], written * sizeof units[0]) != 0)
+			{
+				return Fail("DecodeUTF8", round);
+			}
+		}
+	}
+	return true;
+}
+
+static bool CheckSingleByte()
+{
+	DecodeTableProc const decode[] = { DecodeSingleByte, DecodeSingleByteGeneric, DecodeSingleByteSSE2 };
+	std::vector<unsigned char> octets;
+	std::vector<unsigned short> expected;
+	std::vector<unsigned short> units;
+	for (size_t c = 0; c < sizeof Charsets / sizeof *Charsets; ++c)
+	{
+		DecodeTable table;
+		if (!Load(Charsets[c], table))
+			continue;
+		Converter converter(Charsets[c]);
+		for (unsigned round = 0; round < 2000; ++round)
+		{
+			// Mix runs of ASCII with other octets, but leave out those which
+			// iconv() rejects, as MultiByteToWideChar() maps them to something
+			size_t const n = Random() % 300;
+			octets.resize(n + 1);
+			for (size_t i = 0; i < n; ++i)
+				do
+					octets[i] = static_cast<unsigned char>(Random() % 8 ? 0x20 + Random() % 0x5F : Random() % 0x100);
+				while (table.units[octets[i]] == 0xFFFD);
+			if (converter.convert(&octets[0], n, expected) != n || expected.size() != n)
+				return Fail(Charsets[c].name, round);
+			units.resize(n + 1);
+			for (size_t v = 0; v < 3; ++v)
+			{
+				if (decode[v](&octets[0], n, &table, &units[0]) != n ||
+					memcmp(&units[0], &expected[0], n * sizeof units[0]) != 0)
+				{
+					return Fail(Charsets[c].name, round);
+				}
+			}
+		}
+	}
+#ifdef CHARACTER_SETS_TABLES
+	// Octets of all values, through tables as the system has them
+	for (size_t t = 0; t < sizeof SystemTables / sizeof *SystemTables; ++t)
+	{
+		DecodeTable table;
+		memcpy(table.units, SystemTables[t].units, sizeof table.units);
+		table.init();
+		for (unsigned round = 0; round < 200; ++round)
+		{
+			size_t const n = Random() % 300;
+			octets.resize(n + 1);
+			for (size_t i = 0; i < n; ++i)
+				octets[i] = static_cast<unsigned char>(Random() % 4 ? 0x20 + Random() % 0x5F : Random() % 0x100);
+			units.resize(n + 1);
+			for (size_t v = 0; v < 3; ++v)
+			{
+				decode[v](&octets[0], n, &table, &units[0]);
+				for (size_t i = 0; i < n; ++i)
+					if (units[i] != table.units[octets[i]])
+						return Fail("character-sets-tables.h", SystemTables[t].cp);
+			}
+		}
+	}
+#endif
+	return true;
+}
+
+/**
+ * @brief Decodes lines of 80 octets one by one, as they get drawn.
+ */
+static double Measure(Converter *converter, DecodeTable const *table, std::vector<unsigned char> const &octets)
+{
+	std::vector<unsigned short> q(81);
+	size_t const n = octets.size();
+	size_t total = 0;
+	clock_t const start = clock();
+	for (size_t i = 0; i + 80 <= n; i += 80)
+	{
+		size_t written = 80;
+		if (converter != NULL)
+			total += converter->convert(&octets[i], 80, q);
+		else if (table != NULL)
+			total += DecodeSingleByte(&octets[i], 80, table, &q[0]);
+		else
+			total += DecodeUTF8(&octets[i], 80, &q[0], &written);
+	}
+	double const seconds = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+	if (total == 0)
+		printf("nothing decoded\n");
+	return static_cast<double>(n) / (1 << 20) / seconds;
+}
+
+#ifdef _WIN32
+static char const System[] = "MultiByteToWideChar()";
+#else
+static char const System[] = "iconv()";
+#endif
+
+static void Bench()
+{
+	size_t const n = 32 << 20;
+	std::vector<unsigned char> octets(n);
+	// UTF-8 which is mostly ASCII, and Cyrillic in two-octet sequences
+	for (int k = 0; k < 2; ++k)
+	{
+		for (size_t i = 0; i < n; i += 2)
+		{
+			bool const ascii = k == 0 ? i % 40 != 0 : i % 10 == 0;
+			octets[i] = static_cast<unsigned char>(ascii ? 'a' + i % 26 : 0xD0);
+			octets[i + 1] = static_cast<unsigned char>(ascii ? ' ' : 0x90 + i % 32);
+		}
+		Converter converter(UTF8);
+		double const before = Measure(&converter, NULL, octets);
+		double const after = Measure(NULL, NULL, octets);
+		printf("UTF-8, %s: %s %6.0f MB/s, DecodeUTF8() %6.0f MB/s\n",
+			k == 0 ? "mostly ASCII" : "mostly Cyrillic", System, before, after);
+	}
+	Charset const &cp1252 = Charsets[4];
+	DecodeTable table;
+	if (Load(cp1252, table))
+	{
+		for (size_t i = 0; i < n; ++i)
+			octets[i] = static_cast<unsigned char>(i % 16 == 0 ? 0xE4 : 'a' + i % 26);
+		Converter converter(cp1252);
+		double const before = Measure(&converter, NULL, octets);
+		double const after = Measure(NULL, &table, octets);
+		printf("CP1252, mostly ASCII: %s %6.0f MB/s, DecodeSingleByte() %6.0f MB/s\n", System, before, after);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+	{
+		Bench();
+		return 0;
+	}
+	if (!CheckUTF8() || !CheckSingleByte())
+		return 1;
+	printf("decoder: ok\n");
+	return 0;
+}
@@ -0,0 +1,378 @@
+/*
+ * Checks that LineCodes and LineIndex give back the lines they are given, and
+ * measures how long it takes to locate a line at random, as compared with the
+ * former layout of 8 octets per line, looked up as m_index[HIWORD][LOWORD].
+ * Run with "bench" to measure. A plain allocator stands in for Arena.cpp,
+ * which builds on more of Win32 than windows.h provides.
+ */
+#include <windows.h>
+#include "../Arena.h"
+#include "../LineCodes.h"
+#include "../LineIndex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+struct Arena::Region
+{
+	Region *next;
+};
+
+void *Arena::allocate(size_t size)
+{
+	size_t const header = sizeof(Region) + 15 & ~static_cast<size_t>(15);
+	Region *const region = static_cast<Region *>(aligned_alloc(16, header + (size + 15 & ~static_cast<size_t>(15))));
+	if (region == NULL)
+		return NULL;
+	region->next = m_region;
+	m_region = region;
+	return reinterpret_cast<BYTE *>(region) + header;
+}
+
+void Arena::release()
+{
+	while (Region *const region = m_region)
+	{
+		m_region = region->next;
+		free(region);
+	}
+}
+
+static unsigned Seed = 1;
+
+static unsigned Random()
+{
+	Seed = Seed * 1103515245 + 12345;
+	return Seed >> 8;
+}
+
+static double Now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Makes up a length, with an emphasis on where codes change in size.
+ */
+static UINT RandomLength()
+{
+	UINT const edges[] = { 0, 1, 0xDF, 0xE0, 0x1FDF, 0x1FE0, 0xFFFFFFFE, 0xFFFFFFFF };
+	switch (Random() % 8)
+	{
+	case 0:
+		return edges[Random() % _countof(edges)];
+	case 1:
+		return Random() << 8 ^ Random();
+	case 2:
+		return Random() % 0x2000;
+	default:
+		return Random() % 0x100;
+	}
+}
+
+/**
+ * @brief Makes up lines which follow one another from an offset beyond 4G.
+ */
+static void RandomLines(std::vector<LineData> &lines, size_t count)
+{
+	lines.resize(count);
+	ULONGLONG offset = static_cast<ULONGLONG>(Random()) << 16;
+	for (size_t i = 0; i < count; ++i)
+	{
+		lines[i].offset = offset;
+		offset += lines[i].len = RandomLength();
+	}
+}
+
+static bool Same(LineData const &a, LineData const &b)
+{
+	return a.offset == b.offset && a.len == b.len;
+}
+
+static bool Fail(char const *what, unsigned round)
+{
+	printf("index: %s fails in round %u\n", what, round);
+	return false;
+}
+
+static bool CheckCodes()
+{
+	std::vector<LineData> lines;
+	std::vector<LineData> decoded;
+	std::vector<UINT> lengths;
+	std::vector<BYTE> memory;
+	for (unsigned round = 0; round < 200; ++round)
+	{
+		// Cover full blocks as well as counts on and around multiples of 16
+		UINT const counts[] = { 1, 15, 16, 17, 0x10000, 0xFFFF, 1 + Random() % 0x10000 };
+		UINT const count = counts[round % _countof(counts)];
+		RandomLines(lines, count);
+		UINT const size = LineCodes::measure(&lines[0], count);
+		memory.assign(offsetof(LineCodes, codes) + size, 0xCC);
+		LineCodes *const codes = reinterpret_cast<LineCodes *>(&memory[0]);
+		codes->encode(&lines[0], count);
+		if (!codes->validate(size, count))
+			return Fail("LineCodes::validate()", round);
+		// Cutting off the last code must not go unnoticed
+		UINT const last = lines[count - 1].len;
+		UINT const cut = last < 0xE0 ? 1 : last - 0xE0 < 0x1F00 ? 2 : LineCodes::MaxCodeSize;
+		if (codes->validate(size - 1, count) || codes->validate(size - cut, count))
+			return Fail("LineCodes::validate() on truncated codes", round);
+		decoded.resize(count);
+		codes->decode(&decoded[0], count);
+		for (UINT i = 0; i < count; ++i)
+			if (!Same(decoded[i], lines[i]))
+				return Fail("LineCodes::decode()", round);
+		for (UINT i = 0; i < count; ++i)
+		{
+			LineData linedata;
+			codes->locate(i, linedata);
+			if (!Same(linedata, lines[i]))
+				return Fail("LineCodes::locate()", round);
+		}
+		UINT const i = Random() % count;
+		UINT const n = Random() % (count - i) + 1;
+		lengths.resize(n);
+		codes->lengths(i, &lengths[0], n);
+		for (UINT j = 0; j < n; ++j)
+			if (lengths[j] != lines[i + j].len)
+				return Fail("LineCodes::lengths()", round);
+	}
+	return true;
+}
+
+/**
+ * @brief Checks that an index holds the given lines, and that a file offset
+ * leads back to the line in which it lies.
+ */
+static bool Holds(LineIndex const &index, std::vector<LineData> const &lines, unsigned round)
+{
+	if (index.size() != lines.size())
+		return Fail("LineIndex::size()", round);
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		LineData linedata;
+		if (!index.getAt(i, linedata) || !Same(linedata, lines[i]))
+			return Fail("LineIndex::getAt()", round);
+	}
+	static UINT lengths[0x10000];
+	for (size_t i = 0; i < lines.size(); )
+	{
+		UINT const n = index.getLengths(i, lengths, 0x10000);
+		if (n == 0 || n > 0x10000 - (i & 0xFFFF))
+			return Fail("LineIndex::getLengths()", round);
+		for (UINT j = 0; j < n; ++j)
+			if (lengths[j] != lines[i + j].len)
+				return Fail("LineIndex::getLengths()", round);
+		i += n;
+	}
+	for (unsigned k = 0; k < 1000; ++k)
+	{
+		size_t const i = Random() % lines.size();
+		if (lines[i].len != 0 && index.find(lines[i].offset + Random() % lines[i].len) != i)
+			return Fail("LineIndex::find()", round);
+	}
+	return true;
+}
+
+static bool CheckIndex(char const *path)
+{
+	std::vector<LineData> lines;
+	std::vector<UINT> lengths;
+	for (unsigned round = 0; round < 6; ++round)
+	{
+		// Have the last block end anywhere, including right at its end
+		size_t const count = round % 2 ? 3 * 0x10000 : 2 * 0x10000 + Random() % 0x10000;
+		RandomLines(lines, count);
+		lengths.resize(count);
+		for (size_t i = 0; i < count; ++i)
+			lengths[i] = lines[i].len;
+		LineIndex index;
+		// Append in batches which straddle blocks
+		for (size_t i = 0; i < count; )
+		{
+			UINT const n = static_cast<UINT>(count - i < 50000 ? count - i : 1 + Random() % 50000);
+			if (index.append(lines[i].offset, &lengths[i], n) != n)
+				return Fail("LineIndex::append()", round);
+			i += n;
+		}
+		if (!Holds(index, lines, round))
+			return false;
+		// Write all blocks, and read them back, having the last one thawed
+		// so as to take further lines, as LoadIndex() does
+		HANDLE handle = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+		if (handle == INVALID_HANDLE_VALUE)
+			return Fail("CreateFile()", round);
+		UINT const blocks = static_cast<UINT>((count - 1 >> 16) + 1);
+		bool written = true;
+		for (UINT b = 0; b < blocks; ++b)
+			written = written && index.write(handle, b);
+		CloseHandle(handle);
+		if (!written)
+			return Fail("LineIndex::write()", round);
+		handle = CreateFile(path, GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+		LineIndex copy;
+		bool read = true;
+		for (UINT b = 0; b < blocks; ++b)
+		{
+			UINT const n = b + 1 < blocks ? 0x10000 : static_cast<UINT>(count - (static_cast<size_t>(b) << 16));
+			read = read && copy.read(handle, n, b + 1 == blocks);
+		}
+		CloseHandle(handle);
+		if (!read)
+			return Fail("LineIndex::read()", round);
+		if (!Holds(copy, lines, round))
+			return false;
+		size_t const more = Random() % 0x10000;
+		std::vector<LineData> extra;
+		RandomLines(extra, more);
+		for (size_t i = 0; i < more; ++i)
+		{
+			UINT const len = extra[i].len;
+			LineData linedata = { lines.back().offset + lines.back().len, len };
+			if (copy.append(linedata.offset, &len, 1) != 1)
+				return Fail("LineIndex::append() after read()", round);
+			lines.push_back(linedata);
+		}
+		if (!Holds(copy, lines, round))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Checks matches on either side of where the bitset changes pages.
+ */
+static bool CheckMatches()
+{
+	ULONGLONG const lines[] = { 0, 31, 32, 0xFFFF, 0x10000, 0xFFFFFFFF, 0x100000000ULL, 0xFFFFFFFFFFULL };
+	LineIndex index;
+	for (unsigned round = 0; round < 2; ++round)
+	{
+		for (size_t k = 0; k < _countof(lines); ++k)
+			index.setMatch(lines[k]);
+		for (size_t k = 0; k < _countof(lines); ++k)
+		{
+			if (!index.isMatch(lines[k]) || index.isMatch(lines[k] + 1) != (k + 1 < _countof(lines) && lines[k + 1] == lines[k] + 1))
+				return Fail("LineIndex::isMatch()", round);
+		}
+		// Lines past the last page never match
+		index.setMatch(0x10000000000ULL);
+		if (index.isMatch(0x10000000000ULL))
+			return Fail("LineIndex::setMatch()", round);
+		index.clearMatches();
+		for (size_t k = 0; k < _countof(lines); ++k)
+			if (index.isMatch(lines[k]))
+				return Fail("LineIndex::clearMatches()", round);
+	}
+	return true;
+}
+
+// The former layout, which packed the offset into 38 bits and the length
+// into 24 bits, and looked lines up through an array of 0x10000 pointers
+struct FormerLineData
+{
+	DWORD LowPart;
+	UINT HighPart : 6;
+	UINT flags : 2;
+	UINT len : 24;
+};
+
+// Keeps the compiler from doing away with lookups whose results go unused
+static volatile ULONGLONG Sink;
+
+static void Bench()
+{
+	size_t const count = 16 << 20;
+	size_t const lookups = 1 << 22;
+	LineIndex index;
+	FormerLineData **former = static_cast<FormerLineData **>(calloc(0x10000, sizeof *former));
+	std::vector<UINT> lengths(0x10000);
+	ULONGLONG offset = 0;
+	for (size_t i = 0; i < count; i += 0x10000)
+	{
+		FormerLineData *const block = former[i >> 16] = static_cast<FormerLineData *>(malloc(0x10000 * sizeof *block));
+		for (size_t j = 0; j < 0x10000; ++j)
+		{
+			// Lines of typical log files, mostly of 40 to 200 octets
+			lengths[j] = Random() % 16 ? 40 + Random() % 160 : Random() % 0x1000;
+			block[j].LowPart = static_cast<DWORD>(offset);
+			block[j].HighPart = static_cast<UINT>(offset >> 32);
+			block[j].flags = 0;
+			block[j].len = lengths[j];
+			offset += lengths[j];
+		}
+		ULONGLONG const start = static_cast<ULONGLONG>(block[0].HighPart) << 32 | block[0].LowPart;
+		index.append(start, &lengths[0], 0x10000);
+	}
+	std::vector<size_t> order(lookups);
+	for (size_t k = 0; k < lookups; ++k)
+		order[k] = (static_cast<size_t>(Random()) << 8 ^ Random()) % count;
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		char const *const access = pass == 0 ? "random" : "sequential";
+		ULONGLONG sum = 0;
+		double best[2] = { 1e9, 1e9 };
+		for (int repeat = 0; repeat < 3; ++repeat)
+		{
+			double start = Now();
+			for (size_t k = 0; k < lookups; ++k)
+			{
+				size_t const i = pass == 0 ? order[k] : k;
+				FormerLineData const &linedata = former[HIWORD(i)][LOWORD(i)];
+				sum += (static_cast<ULONGLONG>(linedata.HighPart) << 32 | linedata.LowPart) + linedata.len;
+			}
+			double const before = (Now() - start) / lookups * 1e9;
+			start = Now();
+			for (size_t k = 0; k < lookups; ++k)
+			{
+				LineData linedata;
+				index.getAt(pass == 0 ? order[k] : k, linedata);
+				sum += linedata.offset + linedata.len;
+			}
+			double const after = (Now() - start) / lookups * 1e9;
+			if (best[0] > before)
+				best[0] = before;
+			if (best[1] > after)
+				best[1] = after;
+		}
+		Sink = sum;
+		printf("getAt(), %-10s m_index[HIWORD][LOWORD] %5.1f ns, LineIndex %5.1f ns\n", access, best[0], best[1]);
+	}
+	// Account for what compacted blocks take, along with their pointers
+	ULONGLONG octets = 0;
+	std::vector<LineData> lines(0x10000);
+	for (size_t i = 0; i < count; i += 0x10000)
+	{
+		for (UINT j = 0; j < 0x10000; ++j)
+			index.getAt(i + j, lines[j]);
+		octets += sizeof(void *) + sizeof(void *) + sizeof(UINT) + offsetof(LineCodes, codes) + LineCodes::measure(&lines[0], 0x10000);
+	}
+	printf("size per line: m_index[HIWORD][LOWORD] %.2f octets, LineIndex %.2f octets\n",
+		static_cast<double>(sizeof(FormerLineData)), static_cast<double>(octets) / count);
+	for (size_t i = 0; i < count; i += 0x10000)
+		free(former[i >> 16]);
+	free(former);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+	{
+		Bench();
+		return 0;
+	}
+	char const *const tmp = getenv("TMPDIR");
+	char path[1024];
+	snprintf(path, sizeof path, "%s/index-%d.idx", tmp ? tmp : "/tmp", static_cast<int>(getpid()));
+	bool const ok = CheckCodes() && CheckIndex(path) && CheckMatches();
+	unlink(path);
+	if (!ok)
+		return 1;
+	printf("index: ok\n");
+	return 0;
+}
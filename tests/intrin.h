@@ -0,0 +1,10 @@
+/*
+ * Just enough of the compiler intrinsics to build what windows.h builds.
+ */
+inline unsigned char _BitScanReverse(unsigned long *index, unsigned long mask)
+{
+	if (mask == 0)
+		return 0;
+	*index = static_cast<unsigned long>(63 - __builtin_clzl(mask));
+	return 1;
+}
@@ -0,0 +1,319 @@
+/*
+ * Checks that LineReader splits a file into the same lines whichever way it
+ * gets at the data, and measures how fast it indexes that way, from a cold
+ * cache and from a warm one. Run with "bench" to measure. The bench also has
+ * reads ahead keep from 1 to 8 reads in flight, on the host's own storage and
+ * on slow media as modelled by windows.cpp, so as to tell how many of them
+ * ReadAheadDepth is to default to. The file resides in TMPDIR, or else in
+ * /tmp. LineReader runs on top of windows.h, which maps what it needs of Win32
+ * to POSIX.
+ */
+#include <windows.h>
+#include "../LineReader.h"
+#include "../LineStats.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static unsigned Seed = 1;
+
+static unsigned Random()
+{
+	Seed = Seed * 1103515245 + 12345;
+	return Seed >> 8;
+}
+
+// How LineReader gets at the data
+struct Mode
+{
+	char const *name;
+	bool mapped; // through mapped views rather than reads into its buffer
+	DWORD ahead; // size of the buffers to read ahead into, or 0 if none
+	UINT buffers; // number of such buffers, one more than reads in flight
+	bool overlapped; // whether reads ahead overlap rather than follow one another
+};
+
+static Mode const Modes[] =
+{
+	{ "ReadFile()", false, 0, 0, false },
+	{ "mapped views", true, 0, 0, false },
+	// As configured by ReadAhead=1 and ReadAheadDepth=3
+	{ "read ahead", false, 1 << 20, 4, true },
+	{ "read ahead, synchronous", false, 1 << 20, 4, false },
+};
+
+static double Now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Writes a file of n octets, made of lines of printable ASCII, which
+ * are n / lines octets long on average, and include CR, TAB, and an octet
+ * beyond ASCII here and there. Some
+ * lines are much longer, so as to span chunks and views.
+ */
+static bool Generate(char const *path, size_t n, size_t lines, std::vector<BYTE> *data)
+{
+	std::vector<BYTE> p(n);
+	size_t const average = n / lines;
+	for (size_t i = 0; i < n; )
+	{
+		size_t len = Random() % 1000 ? Random() % (2 * average) : Random() % (0x100000 + average);
+		if (len > n - i - 1)
+			len = n - i - 1;
+		for (size_t j = 0; j < len; ++j)
+			p[i + j] = static_cast<BYTE>(Random() % 64 ? 'a' + j % 26 : "\r\t\xE9"[Random() % 3]);
+		i += len;
+		if (i < n)
+			p[i++] = '\n';
+	}
+	FILE *const file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+	bool const written = fwrite(&p[0], 1, n, file) == n;
+	if (fclose(file) != 0 || !written)
+		return false;
+	if (data)
+		data->swap(p);
+	return true;
+}
+
+/**
+ * @brief Splits data from begin to end into lines which end in delimiter, the
+ * last of which may lack it, as LineReader does.
+ */
+static void Split(std::vector<BYTE> const &data, size_t begin, size_t end, char const *delimiter, std::vector<UINT> &lengths)
+{
+	size_t const length = strlen(delimiter);
+	lengths.clear();
+	size_t start = begin;
+	for (size_t i = begin; i < end; )
+	{
+		if (i + length <= end && memcmp(&data[i], delimiter, length) == 0)
+		{
+			i += length;
+			lengths.push_back(static_cast<UINT>(i - start));
+			start = i;
+		}
+		else
+		{
+			++i;
+		}
+	}
+	if (start < end)
+		lengths.push_back(static_cast<UINT>(end - start));
+}
+
+/**
+ * @brief Gathers statistics about lines as LineReader would, but one octet
+ * at a time, so that octets don't come in runs.
+ */
+static void Tally(std::vector<BYTE> const &data, size_t begin, char const *delimiter, std::vector<UINT> const &lengths, LineStats &stats)
+{
+	size_t const length = strlen(delimiter);
+	size_t i = begin;
+	for (size_t k = 0; k < lengths.size(); ++k)
+	{
+		for (size_t j = 0; j < lengths[k]; ++j)
+			stats.feed(&data[i++], 1);
+		// All lines but the last one end in the delimiter
+		if (lengths[k] >= length && memcmp(&data[i - length], delimiter, length) == 0)
+			stats.endLine();
+	}
+}
+
+static bool Same(LineStats const &a, LineStats const &b)
+{
+	LineStats::Totals x, y;
+	a.settle(x);
+	b.settle(y);
+	for (UINT tabwidth = 1; tabwidth <= 32; tabwidth <<= 1)
+		if (a.width(tabwidth) != b.width(tabwidth))
+			return false;
+	return memcmp(&x, &y, sizeof x) == 0;
+}
+
+/**
+ * @brief Indexes the file from begin to end, as IndexLines() would.
+ * @return Number of lines.
+ */
+static size_t Index(char const *path, Mode const &mode, ULONGLONG begin, ULONGLONG end, char const *delimiter, std::vector<UINT> *lengths, LineStats *stats)
+{
+	HANDLE const handle = CreateFile(path, FILE_GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		return 0;
+	size_t count = 0;
+	{
+		OverlappedSupported = mode.overlapped;
+		LineReader reader(handle);
+		if (mode.mapped)
+			reader.mapViews();
+		else if (mode.ahead)
+			reader.readAhead(mode.ahead, mode.buffers);
+		if (stats)
+			reader.tally(stats);
+		if (strlen(delimiter) > 1)
+			reader.setDelimiter(delimiter, strlen(delimiter));
+		reader.seek(begin);
+		reader.setEnd(end);
+		static UINT block[0x10000];
+		while (size_t const n = reader.readLinesAnsi(block, 0x10000, 0xFFFFFFFF, delimiter[strlen(delimiter) - 1]))
+		{
+			if (lengths)
+				lengths->insert(lengths->end(), block, block + n);
+			count += n;
+			if (n < 0x10000)
+				break;
+		}
+	}
+	CloseHandle(handle);
+	return count;
+}
+
+static bool Check(char const *path)
+{
+	std::vector<BYTE> data;
+	if (!Generate(path, 80 << 20, 1 << 20, &data))
+	{
+		printf("cannot write %s\n", path);
+		return false;
+	}
+	char const *const delimiters[] = { "\n", "\r\n" };
+	std::vector<UINT> expected;
+	std::vector<UINT> found;
+	for (unsigned round = 0; round < 8; ++round)
+	{
+		// Start and end anywhere, as do ranges which are indexed in parallel
+		size_t const begin = round < 2 ? 0 : Random() % (data.size() / 2);
+		size_t const end = round < 2 ? data.size() : data.size() / 2 + Random() % (data.size() / 2);
+		char const *const delimiter = delimiters[round % 2];
+		Split(data, begin, end, delimiter, expected);
+		LineStats reference;
+		Tally(data, begin, delimiter, expected, reference);
+		for (size_t m = 0; m < _countof(Modes); ++m)
+		{
+			found.clear();
+			LineStats stats;
+			Index(path, Modes[m], begin, end, delimiter, &found, &stats);
+			if (found != expected)
+			{
+				printf("reader: %s fails in round %u\n", Modes[m].name, round);
+				return false;
+			}
+			if (!Same(stats, reference))
+			{
+				printf("reader: statistics through %s fail in round %u\n", Modes[m].name, round);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Has the system forget what it has cached of the file.
+ */
+static void Evict(char const *path)
+{
+	int const fd = open(path, O_RDONLY);
+	if (fd != -1)
+	{
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+static double Measure(char const *path, size_t n, Mode const &mode, bool cold, LineStats *stats)
+{
+	if (cold)
+		Evict(path);
+	double const start = Now();
+	if (Index(path, mode, 0, ~0ULL, "\n", NULL, stats) == 0)
+		printf("no lines found\n");
+	return n / (Now() - start) / (1 << 20);
+}
+
+/**
+ * @brief Takes the best of several runs, so as to filter out noise from the host.
+ */
+static double Best(char const *path, size_t n, Mode const &mode, bool cold, int passes, LineStats *stats = NULL)
+{
+	double best = 0;
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		if (stats)
+			stats->clear();
+		double const rate = Measure(path, n, mode, cold, stats);
+		if (best < rate)
+			best = rate;
+	}
+	return best;
+}
+
+/**
+ * @brief Measures reads ahead with depth reads in flight, from 1 to 8.
+ */
+static void Depths(char const *path, size_t n, char const *media, bool cold, int passes)
+{
+	for (int overlapped = 1; overlapped >= 0; --overlapped)
+	{
+		printf("%s, %-11s", media, overlapped ? "overlapped" : "synchronous");
+		for (UINT depth = 1; depth <= 8; ++depth)
+		{
+			Mode const mode = { "", false, 1 << 20, depth + 1, overlapped != 0 };
+			printf(" %5.0f", Best(path, n, mode, cold, passes));
+		}
+		printf(" MB/s at depth 1 to 8\n");
+	}
+}
+
+static void Bench(char const *path)
+{
+	size_t n = 512 << 20;
+	if (!Generate(path, n, n / 80, NULL))
+	{
+		printf("cannot write %s\n", path);
+		return;
+	}
+	for (int cold = 1; cold >= 0; --cold)
+	{
+		for (size_t m = 0; m < _countof(Modes); ++m)
+			printf("%s cache, %-24s %6.0f MB/s\n", cold ? "cold" : "warm", Modes[m].name, Best(path, n, Modes[m], cold != 0, 3));
+	}
+	// What gathering statistics along the way costs
+	LineStats stats;
+	printf("warm cache, %-24s %6.0f MB/s with statistics\n", Modes[0].name, Best(path, n, Modes[0], false, 3, &stats));
+	Depths(path, n, "cold cache", true, 3);
+	// Model a spinning disk or a network share, which takes 5ms to seek or
+	// to respond, and transfers 100MB/s. A smaller file does, as it is all
+	// about waiting, which also makes a single pass do.
+	n = 64 << 20;
+	if (!Generate(path, n, n / 80, NULL))
+		return;
+	SlowMedia.latency = 5000;
+	SlowMedia.rate = 100e6;
+	Depths(path, n, "slow media", false, 1);
+	SlowMedia.latency = 0;
+	SlowMedia.rate = 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char const *const tmp = getenv("TMPDIR");
+	char path[1024];
+	snprintf(path, sizeof path, "%s/reader-%d.txt", tmp ? tmp : "/tmp", static_cast<int>(getpid()));
+	bool ok = true;
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+		Bench(path);
+	else if ((ok = Check(path)) != false)
+		printf("reader: ok\n");
+	unlink(path);
+	return ok ? 0 : 1;
+}
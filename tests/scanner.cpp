@@ -0,0 +1,269 @@
+/*
+ * Checks the delimiter scanners against plain loops, and measures how they
+ * compare with the memchr() loop they replace. Likewise checks and measures
+ * the single pass in which ExpandIdentity() widens a line and expands its tabs
+ * against widening it and having ExpandTabs() go over it, and checks how far
+ * SkipPlain() gets. Run with "bench" to measure.
+ */
+#include "../Scanner.cpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+static unsigned Seed = 1;
+
+static unsigned Random()
+{
+	Seed = Seed * 1103515245 + 12345;
+	return Seed >> 8;
+}
+
+static size_t ReferenceOctets(BYTE const *p, size_t n, BYTE eol, WORD *offsets)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < n; ++i)
+		if (p[i] == eol)
+			offsets[count++] = static_cast<WORD>(i + 1);
+	return count;
+}
+
+static size_t ReferenceWords(BYTE const *p, size_t n, WORD eol, WORD *offsets)
+{
+	size_t count = 0;
+	for (size_t i = 0; i + 1 < n; i += 2)
+		if (p[i] == (eol & 0xFF) && p[i + 1] == (eol >> 8))
+			offsets[count++] = static_cast<WORD>(i + 2);
+	return count;
+}
+
+static size_t ReferenceWiden(BYTE const *p, size_t n, WCHAR *q)
+{
+	size_t i = 0;
+	while (i < n && p[i] >= 0x20 && p[i] <= 0x7E)
+	{
+		q[i] = p[i];
+		++i;
+	}
+	return i;
+}
+
+static size_t ReferenceSkip(BYTE const *p, size_t n)
+{
+	size_t i = 0;
+	while (i < n && p[i] <= 0x7F && p[i] != 0x09 && p[i] != 0x0A && p[i] != 0x0D)
+		++i;
+	return i;
+}
+
+/**
+ * @brief Widens octets as Transcode() does for those which map to themselves,
+ * and expands tabs as ExpandTabs() does.
+ * @return Whether all octets map to themselves.
+ */
+static bool ReferenceExpand(BYTE const *p, size_t n, DWORD const *identity, UINT tabwidth, std::vector<WCHAR> &q)
+{
+	std::vector<WCHAR> text(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		BYTE const c = p[i];
+		if (c != '\t' && (c < 0x20 || c > 0x7E) && (c >= 0x80 || !(identity[c >> 5] & (1UL << (c & 31)))))
+			return false;
+		text[i] = c;
+	}
+	UINT const tabmask = tabwidth - 1;
+	UINT w = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (text[i] == '\t')
+			w |= tabmask;
+		++w;
+	}
+	q.resize(w);
+	w = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		WCHAR c = text[i];
+		if (c == '\t')
+		{
+			c = ' ';
+			while ((w & tabmask) != tabmask)
+				q[w++] = c;
+		}
+		q[w++] = c;
+	}
+	return true;
+}
+
+/**
+ * @brief Goes through ExpandIdentity() the way MainWindow::ExpandPlain() does.
+ */
+static bool Expand(BYTE const *p, size_t n, DWORD const *identity, UINT tabwidth, std::vector<WCHAR> &q)
+{
+	size_t capacity = n;
+	WCHAR *wide = static_cast<WCHAR *>(malloc((capacity + 1) * sizeof *wide));
+	size_t i = 0;
+	size_t w = 0;
+	for (;;)
+	{
+		i += ExpandIdentity(p + i, n - i, identity, tabwidth, wide, capacity, &w);
+		if (i == n || p[i] != '\t')
+			break;
+		capacity = w + tabwidth + (n - i) + capacity / 2;
+		wide = static_cast<WCHAR *>(realloc(wide, (capacity + 1) * sizeof *wide));
+	}
+	q.assign(wide, wide + w);
+	free(wide);
+	return i == n;
+}
+
+static bool Fail(char const *what, unsigned round)
+{
+	printf("%s: mismatch in round %u\n", what, round);
+	return false;
+}
+
+/**
+ * @brief Fills a buffer with octets among which a few keep coming up, so that
+ * delimiters, code units made of them, and runs of printable ASCII all occur.
+ */
+static void Fill(BYTE *p, size_t n)
+{
+	BYTE const common[] = { '\n', '\r', 0x00, '\t', 0x85, 0xFF, 'a', ' ' };
+	unsigned const density = 1 + Random() % 64;
+	for (size_t i = 0; i < n; ++i)
+		p[i] = static_cast<BYTE>(Random() % density == 0 ? common[Random() % 8] : 0x20 + Random() % 0x5F);
+}
+
+static bool Check()
+{
+	static BYTE buffer[ScanStride + 64];
+	static WORD expected[ScanStride];
+	static WORD found[ScanStride];
+	static WCHAR wide[ScanStride + 64];
+	static WCHAR wider[ScanStride + 64];
+	ScanProc const octets[] = { ScanOctets, ScanOctetsGeneric, ScanOctetsSSE2 };
+	ScanWideProc const words[] = { ScanWords, ScanWordsGeneric, ScanWordsSSE2 };
+	WidenProc const widen[] = { WidenPrintable, WidenPrintableGeneric, WidenPrintableSSE2 };
+	SkipProc const skip[] = { SkipPlain, SkipPlainGeneric, SkipPlainSSE2 };
+	for (unsigned round = 0; round < 20000; ++round)
+	{
+		// Vary both the length and the alignment, which may be odd
+		size_t const n = round % 4 ? Random() % 300 : Random() % (ScanStride + 1);
+		BYTE *const p = buffer + Random() % 17;
+		Fill(p, n);
+		BYTE const eol = p[n ? Random() % n : 0];
+		size_t const count = ReferenceOctets(p, n, eol, expected);
+		for (size_t v = 0; v < 3; ++v)
+			if (octets[v](p, n, eol, found) != count || memcmp(found, expected, count * sizeof *found))
+				return Fail("ScanOctets", round);
+		WORD const key = static_cast<WORD>(eol | (Random() % 2 ? p[n > 1 ? Random() % (n - 1) + 1 : 0] << 8 : 0));
+		size_t const units = ReferenceWords(p, n, key, expected);
+		for (size_t v = 0; v < 3; ++v)
+			if (words[v](p, n, key, found) != units || memcmp(found, expected, units * sizeof *found))
+				return Fail("ScanWords", round);
+		// Make runs of printable ASCII long enough to span several blocks
+		if (round % 2)
+			for (size_t i = 0; i < n; ++i)
+				if (Random() % 512)
+					p[i] = static_cast<BYTE>(0x20 + p[i] % 0x5F);
+		size_t const printable = ReferenceWiden(p, n, wide);
+		for (size_t v = 0; v < 3; ++v)
+			if (widen[v](p, n, wider) != printable || memcmp(wider, wide, printable * sizeof *wide))
+				return Fail("WidenPrintable", round);
+		size_t const plain = ReferenceSkip(p, n);
+		for (size_t v = 0; v < 3; ++v)
+			if (skip[v](p, n) != plain)
+				return Fail("SkipPlain", round);
+	}
+	for (unsigned round = 0; round < 20000; ++round)
+	{
+		size_t const n = round % 4 ? Random() % 300 : Random() % (ScanStride + 1);
+		BYTE *const p = buffer + Random() % 17;
+		unsigned const density = 1 + Random() % 64;
+		for (size_t i = 0; i < n; ++i)
+			p[i] = static_cast<BYTE>(Random() % density ? 0x20 + Random() % 0x5F : Random() % 2 ? '\t' : Random() % 0x100);
+		DWORD identity[4] = { Random(), 0xFFFFFFFF, 0xFFFFFFFF, 0x7FFFFFFF | Random() << 31 };
+		UINT const tabwidth = 1U << Random() % 5;
+		std::vector<WCHAR> expected;
+		std::vector<WCHAR> expanded;
+		bool const plain = ReferenceExpand(p, n, identity, tabwidth, expected);
+		if (Expand(p, n, identity, tabwidth, expanded) != plain || (plain && expanded != expected))
+			return Fail("ExpandIdentity", round);
+	}
+	return true;
+}
+
+// Takes the best of repeat passes, so as to filter out noise from the host
+static double Measure(ScanProc scan, BYTE const *p, size_t n, unsigned repeat)
+{
+	static WORD offsets[ScanStride];
+	size_t total = 0;
+	double best = 0;
+	for (unsigned r = 0; r < repeat; ++r)
+	{
+		clock_t const start = clock();
+		for (size_t i = 0; i < n; i += ScanStride)
+			total += scan(p + i, n - i < ScanStride ? n - i : ScanStride, '\n', offsets);
+		double const seconds = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+		if (seconds > 0 && static_cast<double>(n) / (1 << 20) / seconds > best)
+			best = static_cast<double>(n) / (1 << 20) / seconds;
+	}
+	if (total == 0)
+		printf("no delimiters found\n");
+	return best;
+}
+
+static void Bench()
+{
+	size_t const n = 64 << 20;
+	BYTE *const p = static_cast<BYTE *>(malloc(n));
+	size_t const lengths[] = { 8, 80, 200, 1000, 10000 };
+	for (size_t k = 0; k < 5; ++k)
+	{
+		for (size_t i = 0; i < n; ++i)
+			p[i] = static_cast<BYTE>(i % lengths[k] == lengths[k] - 1 ? '\n' : 'a' + i % 26);
+		double const before = Measure(ScanOctetsGeneric, p, n, 8);
+		double const after = Measure(ScanOctetsSSE2, p, n, 8);
+		printf("ScanOctets, lines of %4u octets: memchr() loop %6.0f MB/s, SSE2 %6.0f MB/s\n",
+			static_cast<unsigned>(lengths[k]), before, after);
+	}
+	for (size_t i = 0; i < n; ++i)
+		p[i] = static_cast<BYTE>(i % 80 == 79 ? '\n' : i % 80 % 20 == 0 ? '\t' : 'a' + i % 26);
+	DWORD const identity[4] = { 0x00000200, 0xFFFFFFFF, 0xFFFFFFFF, 0x7FFFFFFF };
+	std::vector<WCHAR> q;
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		size_t total = 0;
+		clock_t const start = clock();
+		// Expand the lines one by one, as they get drawn
+		for (size_t i = 0; i < n; i += 80)
+		{
+			if (pass == 0)
+				ReferenceExpand(p + i, 79, identity, 4, q);
+			else
+				Expand(p + i, 79, identity, 4, q);
+			total += q.size();
+		}
+		double const seconds = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+		printf("%-28s lines of 80 octets with tabs: %6.0f MB/s\n",
+			pass == 0 ? "Widening, then ExpandTabs():" : "ExpandIdentity():",
+			static_cast<double>(n) / (1 << 20) / seconds);
+		if (total == 0)
+			printf("nothing expanded\n");
+	}
+	free(p);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+	{
+		Bench();
+		return 0;
+	}
+	if (!Check())
+		return 1;
+	printf("scanner: ok\n");
+	return 0;
+}
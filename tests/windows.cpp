@@ -0,0 +1,397 @@
+/*
+ * Implements windows.h on top of POSIX threads and files. Reads through a
+ * handle opened for overlapped I/O run on threads of their own, so that any
+ * number of them can be in flight. Reads can be made to take as long as they
+ * would on slow media, as configured through SlowMedia: each read waits out
+ * the latency while others may do the same, and then transfers at the rate,
+ * while others wait for their turn.
+ */
+#include <windows.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+
+SlowMediaModel SlowMedia = { 0, 0 };
+bool OverlappedSupported = true;
+
+static pthread_mutex_t Medium = PTHREAD_MUTEX_INITIALIZER;
+static __thread DWORD LastError = 0;
+
+/**
+ * @brief Takes as long as the medium would take to deliver size octets.
+ */
+static void Transfer(size_t size)
+{
+	if (SlowMedia.latency)
+		usleep(SlowMedia.latency);
+	if (SlowMedia.rate)
+	{
+		pthread_mutex_lock(&Medium);
+		double const seconds = size / SlowMedia.rate;
+		timespec ts;
+		ts.tv_sec = static_cast<time_t>(seconds);
+		ts.tv_nsec = static_cast<long>((seconds - ts.tv_sec) * 1e9);
+		nanosleep(&ts, NULL);
+		pthread_mutex_unlock(&Medium);
+	}
+}
+
+// What a HANDLE refers to
+struct Object
+{
+	enum Kind { File, Event, Semaphore, Thread, Mapping } kind;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int fd; // File, Mapping
+	bool overlapped; // File
+	bool manual; // Event
+	long count; // Event: whether set, Semaphore: count, Thread: whether done
+	long maximum; // Semaphore
+	pthread_t thread; // Thread
+	LPTHREAD_START_ROUTINE start; // Thread
+	LPVOID param; // Thread
+	explicit Object(Kind kind) : kind(kind), fd(-1), overlapped(false), manual(false), count(0), maximum(0)
+	{
+		pthread_mutex_init(&mutex, NULL);
+		pthread_cond_init(&cond, NULL);
+	}
+	~Object()
+	{
+		if (kind == Thread)
+			pthread_join(thread, NULL);
+		if (fd != -1)
+			close(fd);
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&mutex);
+	}
+	void signal(long value)
+	{
+		pthread_mutex_lock(&mutex);
+		count = value;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&mutex);
+	}
+};
+
+static Object *ObjectFrom(HANDLE h)
+{
+	return static_cast<Object *>(h);
+}
+
+static off_t OffsetFrom(OVERLAPPED const *ov)
+{
+	return static_cast<off_t>(static_cast<ULONGLONG>(ov->OffsetHigh) << 32 | ov->Offset);
+}
+
+HANDLE CreateFile(char const *path, DWORD access, DWORD, void *, DWORD disposition, DWORD flags, HANDLE)
+{
+	int const fd = access & GENERIC_WRITE ?
+		open(path, O_RDWR | O_CREAT | (disposition == CREATE_ALWAYS ? O_TRUNC : 0), 0600) :
+		open(path, O_RDONLY);
+	if (fd == -1)
+		return INVALID_HANDLE_VALUE;
+	Object *const object = new Object(Object::File);
+	object->fd = fd;
+	object->overlapped = (flags & FILE_FLAG_OVERLAPPED) != 0;
+	return object;
+}
+
+static HANDLE WINAPI ReOpenFile(HANDLE h, DWORD, DWORD, DWORD flags)
+{
+	if (!OverlappedSupported)
+		return INVALID_HANDLE_VALUE;
+	Object *const object = new Object(Object::File);
+	object->fd = dup(ObjectFrom(h)->fd);
+	object->overlapped = (flags & FILE_FLAG_OVERLAPPED) != 0;
+	return object;
+}
+
+BOOL CloseHandle(HANDLE h)
+{
+	delete ObjectFrom(h);
+	return TRUE;
+}
+
+BOOL GetFileSizeEx(HANDLE h, LARGE_INTEGER *size)
+{
+	struct stat st;
+	if (fstat(ObjectFrom(h)->fd, &st) != 0)
+		return FALSE;
+	size->QuadPart = st.st_size;
+	return TRUE;
+}
+
+DWORD GetLastError()
+{
+	return LastError;
+}
+
+HANDLE CreateEvent(void *, BOOL manual, BOOL initial, void *)
+{
+	Object *const object = new Object(Object::Event);
+	object->manual = manual != FALSE;
+	object->count = initial != FALSE;
+	return object;
+}
+
+BOOL SetEvent(HANDLE h)
+{
+	ObjectFrom(h)->signal(1);
+	return TRUE;
+}
+
+BOOL ResetEvent(HANDLE h)
+{
+	ObjectFrom(h)->signal(0);
+	return TRUE;
+}
+
+HANDLE CreateSemaphore(void *, LONG initial, LONG maximum, void *)
+{
+	Object *const object = new Object(Object::Semaphore);
+	object->count = initial;
+	object->maximum = maximum;
+	return object;
+}
+
+BOOL ReleaseSemaphore(HANDLE h, LONG count, LONG *)
+{
+	Object *const object = ObjectFrom(h);
+	pthread_mutex_lock(&object->mutex);
+	object->count += count;
+	if (object->count > object->maximum)
+		object->count = object->maximum;
+	pthread_cond_broadcast(&object->cond);
+	pthread_mutex_unlock(&object->mutex);
+	return TRUE;
+}
+
+static void *StartThread(void *pv)
+{
+	Object *const object = static_cast<Object *>(pv);
+	object->start(object->param);
+	object->signal(1);
+	return NULL;
+}
+
+HANDLE CreateThread(void *, SIZE_T, LPTHREAD_START_ROUTINE start, LPVOID param, DWORD, DWORD *)
+{
+	Object *const object = new Object(Object::Thread);
+	object->start = start;
+	object->param = param;
+	if (pthread_create(&object->thread, NULL, StartThread, object) != 0)
+	{
+		object->kind = Object::Event;
+		delete object;
+		return NULL;
+	}
+	return object;
+}
+
+DWORD WaitForSingleObject(HANDLE h, DWORD milliseconds)
+{
+	Object *const object = ObjectFrom(h);
+	pthread_mutex_lock(&object->mutex);
+	while (object->count == 0 && milliseconds != 0)
+		pthread_cond_wait(&object->cond, &object->mutex);
+	DWORD const result = object->count != 0 ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+	if (result == WAIT_OBJECT_0 && (object->kind == Object::Semaphore || (object->kind == Object::Event && !object->manual)))
+		--object->count;
+	pthread_mutex_unlock(&object->mutex);
+	return result;
+}
+
+// A read which is in flight on a handle opened for overlapped I/O
+struct Request
+{
+	int fd;
+	void *buffer;
+	DWORD count;
+	OVERLAPPED *ov;
+};
+
+static void *CompleteRequest(void *pv)
+{
+	Request *const request = static_cast<Request *>(pv);
+	OVERLAPPED *const ov = request->ov;
+	Transfer(request->count);
+	ssize_t const bytes = pread(request->fd, request->buffer, request->count, OffsetFrom(ov));
+	ov->Internal = bytes < 0 ? errno : bytes == 0 ? ERROR_HANDLE_EOF : 0;
+	ov->InternalHigh = bytes < 0 ? 0 : bytes;
+	delete request;
+	SetEvent(ov->hEvent);
+	return NULL;
+}
+
+BOOL ReadFile(HANDLE h, void *buffer, DWORD count, DWORD *bytes, OVERLAPPED *ov)
+{
+	Object *const object = ObjectFrom(h);
+	if (object->overlapped)
+	{
+		ResetEvent(ov->hEvent);
+		Request *const request = new Request;
+		request->fd = object->fd;
+		request->buffer = buffer;
+		request->count = count;
+		request->ov = ov;
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, CompleteRequest, request) != 0)
+		{
+			delete request;
+			LastError = EAGAIN;
+			return FALSE;
+		}
+		pthread_detach(thread);
+		LastError = ERROR_IO_PENDING;
+		return FALSE;
+	}
+	Transfer(count);
+	ssize_t const n = ov ? pread(object->fd, buffer, count, OffsetFrom(ov)) : read(object->fd, buffer, count);
+	*bytes = n < 0 ? 0 : static_cast<DWORD>(n);
+	if (n < 0 || (n == 0 && count != 0 && ov))
+	{
+		LastError = n < 0 ? errno : ERROR_HANDLE_EOF;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL WriteFile(HANDLE h, void const *buffer, DWORD count, DWORD *bytes, OVERLAPPED *ov)
+{
+	Object *const object = ObjectFrom(h);
+	ssize_t const n = ov ? pwrite(object->fd, buffer, count, OffsetFrom(ov)) : write(object->fd, buffer, count);
+	*bytes = n < 0 ? 0 : static_cast<DWORD>(n);
+	if (n < 0)
+	{
+		LastError = errno;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+BOOL GetOverlappedResult(HANDLE, OVERLAPPED *ov, DWORD *bytes, BOOL)
+{
+	WaitForSingleObject(ov->hEvent, INFINITE);
+	*bytes = static_cast<DWORD>(ov->InternalHigh);
+	LastError = static_cast<DWORD>(ov->Internal);
+	return ov->Internal == 0;
+}
+
+BOOL CancelIo(HANDLE)
+{
+	return TRUE;
+}
+
+HANDLE CreateFileMapping(HANDLE h, void *, DWORD, DWORD, DWORD, void *)
+{
+	Object *const object = new Object(Object::Mapping);
+	object->fd = dup(ObjectFrom(h)->fd);
+	return object;
+}
+
+// Sizes of mapped views by their addresses
+static std::map<void const *, size_t> Views;
+static pthread_mutex_t ViewsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+void *MapViewOfFile(HANDLE h, DWORD, DWORD high, DWORD low, SIZE_T size)
+{
+	void *const p = mmap(NULL, size, PROT_READ, MAP_SHARED, ObjectFrom(h)->fd,
+		static_cast<off_t>(static_cast<ULONGLONG>(high) << 32 | low));
+	if (p == MAP_FAILED)
+		return NULL;
+	pthread_mutex_lock(&ViewsMutex);
+	Views[p] = size;
+	pthread_mutex_unlock(&ViewsMutex);
+	return p;
+}
+
+BOOL UnmapViewOfFile(void const *p)
+{
+	pthread_mutex_lock(&ViewsMutex);
+	std::map<void const *, size_t>::iterator const it = Views.find(p);
+	size_t size = 0;
+	if (it != Views.end())
+	{
+		size = it->second;
+		Views.erase(it);
+	}
+	pthread_mutex_unlock(&ViewsMutex);
+	return size != 0 && munmap(const_cast<void *>(p), size) == 0;
+}
+
+LPVOID VirtualAlloc(LPVOID, SIZE_T size, DWORD, DWORD)
+{
+	return calloc(1, size);
+}
+
+BOOL VirtualFree(LPVOID p, SIZE_T, DWORD)
+{
+	free(p);
+	return TRUE;
+}
+
+HANDLE GetProcessHeap()
+{
+	return NULL;
+}
+
+LPVOID HeapAlloc(HANDLE, DWORD, SIZE_T size)
+{
+	return calloc(1, size);
+}
+
+BOOL HeapFree(HANDLE, DWORD, LPVOID p)
+{
+	free(p);
+	return TRUE;
+}
+
+LPVOID CoTaskMemAlloc(SIZE_T size)
+{
+	return malloc(size);
+}
+
+void CoTaskMemFree(LPVOID p)
+{
+	free(p);
+}
+
+HANDLE GetCurrentProcess()
+{
+	return INVALID_HANDLE_VALUE;
+}
+
+void GetSystemInfo(SYSTEM_INFO *si)
+{
+	si->dwNumberOfProcessors = static_cast<DWORD>(sysconf(_SC_NPROCESSORS_ONLN));
+	si->dwAllocationGranularity = 0x10000;
+}
+
+struct MemoryRange { LPVOID VirtualAddress; SIZE_T NumberOfBytes; };
+
+static BOOL WINAPI PrefetchVirtualMemory(HANDLE, ULONG_PTR count, MemoryRange *ranges, ULONG)
+{
+	for (ULONG_PTR i = 0; i < count; ++i)
+		madvise(ranges[i].VirtualAddress, ranges[i].NumberOfBytes, MADV_WILLNEED);
+	return TRUE;
+}
+
+HMODULE GetModuleHandle(char const *)
+{
+	return NULL;
+}
+
+FARPROC GetProcAddress(HMODULE, char const *name)
+{
+	if (strcmp(name, "PrefetchVirtualMemory") == 0)
+		return reinterpret_cast<FARPROC>(PrefetchVirtualMemory);
+	if (strcmp(name, "ReOpenFile") == 0)
+		return reinterpret_cast<FARPROC>(ReOpenFile);
+	return NULL;
+}
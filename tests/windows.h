@@ -0,0 +1,130 @@
+/*
+ * Just enough of Win32, on top of POSIX threads and files, to build and run
+ * LineReader, LineIndex and what they depend on. See windows.cpp for how reads can be
+ * made to take as long as they would on slow media.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int DWORD;
+typedef unsigned int UINT;
+typedef unsigned int ULONG;
+typedef int LONG;
+typedef int BOOL;
+typedef long long LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef size_t SIZE_T;
+typedef uintptr_t ULONG_PTR;
+typedef unsigned short WCHAR;
+typedef void *LPVOID;
+typedef void *HANDLE;
+typedef HANDLE HMODULE;
+typedef DWORD (*LPTHREAD_START_ROUTINE)(LPVOID);
+typedef int (*FARPROC)();
+
+#define WINAPI
+#define TEXT(s) s
+#define TRUE 1
+#define FALSE 0
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define ERROR_HANDLE_EOF 38
+#define ERROR_IO_PENDING 997
+#define INVALID_HANDLE_VALUE (reinterpret_cast<HANDLE>(-1))
+#define GENERIC_READ 0x80000000
+#define GENERIC_WRITE 0x40000000
+#define FILE_GENERIC_READ 0x120089
+#define FILE_SHARE_READ 1
+#define FILE_SHARE_WRITE 2
+#define FILE_SHARE_DELETE 4
+#define CREATE_ALWAYS 2
+#define OPEN_EXISTING 3
+#define FILE_FLAG_OVERLAPPED 0x40000000
+#define FILE_FLAG_SEQUENTIAL_SCAN 0x08000000
+#define MEM_COMMIT 0x1000
+#define MEM_RESERVE 0x2000
+#define MEM_RELEASE 0x8000
+#define PAGE_READONLY 2
+#define PAGE_READWRITE 4
+#define FILE_MAP_READ 4
+#define HEAP_ZERO_MEMORY 8
+#define LOWORD(l) (static_cast<WORD>(l))
+#define HIWORD(l) (static_cast<WORD>((l) >> 16))
+#define ZeroMemory(p, n) memset((p), 0, (n))
+#define CopyMemory(p, q, n) memcpy((p), (q), (n))
+#define C_ASSERT(e) typedef char C_ASSERT_[(e) ? 1 : -1] __attribute__((unused))
+#define _countof(a) (sizeof (a) / sizeof *(a))
+#define __declspec(x) __declspec_##x
+#define __declspec_thread __thread
+#define _memccpy memccpy
+
+union LARGE_INTEGER
+{
+	struct { DWORD LowPart; LONG HighPart; };
+	LONGLONG QuadPart;
+};
+
+union ULARGE_INTEGER
+{
+	struct { DWORD LowPart; DWORD HighPart; };
+	ULONGLONG QuadPart;
+};
+
+struct OVERLAPPED
+{
+	ULONG_PTR Internal; // error code of the read
+	ULONG_PTR InternalHigh; // number of octets read
+	DWORD Offset;
+	DWORD OffsetHigh;
+	HANDLE hEvent;
+};
+
+struct SYSTEM_INFO
+{
+	DWORD dwNumberOfProcessors;
+	DWORD dwAllocationGranularity;
+};
+
+// How long reads take beyond what the host takes for them
+struct SlowMediaModel
+{
+	unsigned latency; // microseconds until a read starts to transfer
+	double rate; // octets per second for one transfer after another, or 0 if unlimited
+};
+
+extern SlowMediaModel SlowMedia;
+extern bool OverlappedSupported; // whether ReOpenFile() lets reads overlap
+
+HANDLE CreateFile(char const *path, DWORD access, DWORD share, void *, DWORD disposition, DWORD flags, HANDLE);
+BOOL CloseHandle(HANDLE);
+BOOL GetFileSizeEx(HANDLE, LARGE_INTEGER *);
+BOOL ReadFile(HANDLE, void *, DWORD, DWORD *, OVERLAPPED *);
+BOOL WriteFile(HANDLE, void const *, DWORD, DWORD *, OVERLAPPED *);
+BOOL GetOverlappedResult(HANDLE, OVERLAPPED *, DWORD *, BOOL wait);
+BOOL CancelIo(HANDLE);
+DWORD GetLastError();
+HANDLE CreateEvent(void *, BOOL manual, BOOL initial, void *);
+BOOL SetEvent(HANDLE);
+BOOL ResetEvent(HANDLE);
+HANDLE CreateSemaphore(void *, LONG initial, LONG maximum, void *);
+BOOL ReleaseSemaphore(HANDLE, LONG, LONG *);
+HANDLE CreateThread(void *, SIZE_T, LPTHREAD_START_ROUTINE, LPVOID, DWORD, DWORD *);
+DWORD WaitForSingleObject(HANDLE, DWORD);
+HANDLE CreateFileMapping(HANDLE, void *, DWORD, DWORD, DWORD, void *);
+void *MapViewOfFile(HANDLE, DWORD, DWORD high, DWORD low, SIZE_T);
+BOOL UnmapViewOfFile(void const *);
+LPVOID VirtualAlloc(LPVOID, SIZE_T, DWORD, DWORD);
+BOOL VirtualFree(LPVOID, SIZE_T, DWORD);
+HANDLE GetProcessHeap();
+LPVOID HeapAlloc(HANDLE, DWORD, SIZE_T);
+BOOL HeapFree(HANDLE, DWORD, LPVOID);
+LPVOID CoTaskMemAlloc(SIZE_T);
+void CoTaskMemFree(LPVOID);
+HANDLE GetCurrentProcess();
+void GetSystemInfo(SYSTEM_INFO *);
+HMODULE GetModuleHandle(char const *);
+FARPROC GetProcAddress(HMODULE, char const *);
@@ -86,12 +86,15 @@ LPTSTR EatPrefix(LPCTSTR text, LPCTSTR prefix, BOOL strict)
 	return NULL;
 }
 
-BSTR ExpandTabs(BSTR text, UINT tabwidth)
+/**
+ * @brief Expands tabs to tabwidth, taking text to start at column.
+ */
+BSTR ExpandTabs(BSTR text, UINT tabwidth, UINT column)
 {
 	UINT n = SysStringLen(text);
 	UINT tabmask = tabwidth - 1;
 	bool t = false;
-	UINT w = 0;
+	UINT w = column;
 	UINT i;
 	for (i = 0; i < n; ++i)
 	{
@@ -104,9 +107,9 @@ BSTR ExpandTabs(BSTR text, UINT tabwidth)
 	}
 	if (t)
 	{
-		if (BSTR wide = SysAllocStringLen(NULL, w))
+		if (BSTR wide = SysAllocStringLen(NULL, w - column))
 		{
-			w = 0;
+			w = column;
 			for (i = 0; i < n; ++i)
 			{
 				WCHAR c = text[i];
@@ -114,9 +117,9 @@ BSTR ExpandTabs(BSTR text, UINT tabwidth)
 				{
 					c = L' ';
 					while ((w & tabmask) != tabmask)
-						wide[w++] = c;
+						wide[w++ - column] = c;
 				}
-				wide[w++] = c;
+				wide[w++ - column] = c;
 			}
 			SysFreeString(text);
 			text = wide;
@@ -148,7 +148,7 @@ inline char *NumToStr(UINT64 value, char *current = &pod<32>()[32])
 HANDLE Run(LPTSTR szCmdLine, LPCTSTR szDir, HANDLE *phReadPipe, WORD wShowWindow);
 LPTSTR EscapeArgument(LPTSTR p, LPCTSTR q);
 LPTSTR EatPrefix(LPCTSTR text, LPCTSTR prefix, BOOL strict = FALSE);
-BSTR ExpandTabs(BSTR text, UINT tabwidth);
+BSTR ExpandTabs(BSTR text, UINT tabwidth, UINT column = 0);
 BSTR GetWindowText(HWND);
 BSTR GetMenuSelText(HMENU, int, UINT);
 int CheckMenuInt(HMENU, int, UINT, int);